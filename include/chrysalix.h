@@ -78,6 +78,7 @@
      */
 #  include <cx_arch.h>
 #  include <chrysalix/queue.h>
+#  include <chrysalix/pqueue.h>
 #  include <chrysalix/list.h>
 #  include <chrysalix/cx_err.h>
 #  include <chrysalix/cx.h>
@@ -96,6 +97,7 @@
 #  include <chrysalix/cx_proc.h>
 #  include <chrysalix/cx_time.h>
 #  include <chrysalix/cx_ring.h>
+#  include <chrysalix/cx_task.h>
 
 /*****************************************************************
  * Compatible Macros
@@ -104,7 +106,10 @@
 /*****************************************************************
  * Globals
  */
-extern i32       errno;
+i32 *cx_errno(void);
+
+    /** errno belongs to the thread that is running */
+#define errno       (*cx_errno())
 
 
 #endif /* _CHRYSALIX_H */
@@ -49,6 +49,7 @@ struct mem
 {
     struct mem    *next;
     u32           size;
+    u32           owner;    /**< Group charged for the block while in use */
 };
 
 /**
@@ -30,6 +30,60 @@
 #ifndef _CX_PROC_H
 #define _CX_PROC_H
 
+/*****************************************************************
+ * Defines
+ */
+    /** Number of thread priority levels */
+#define CX_PRIO_LEVELS      32
+    /** Most urgent priority level */
+#define CX_PRIO_HIGHEST     0
+    /** Least urgent priority level */
+#define CX_PRIO_LOWEST      (CX_PRIO_LEVELS - 1)
+    /** Priority level used by cx_thread_start() */
+#define CX_PRIO_DEFAULT     (CX_PRIO_LEVELS / 2)
+    /** Weight of a thread unless set, its share of the cpu among its level */
+#define CX_WEIGHT_DEFAULT   1024
+    /** Largest weight */
+#define CX_WEIGHT_MAX       (64 * CX_WEIGHT_DEFAULT)
+    /** Exit status of a thread ended by another with cx_thread_end() */
+#define CX_EXIT_ENDED       (-1)
+
+/*****************************************************************
+ * Structures
+ */
+
+/**
+ * How long threads waited from being woken up until they ran, in
+ * nsecs.  The percentiles are the upper bounds of the histogram
+ * buckets they fall in, so they may be up to twice the real value.
+ */
+struct cx_lat
+{
+    u32     samples;
+    u32     p50;
+    u32     p99;
+    u32     p999;
+    u32     max;
+};
+
+/**
+ * Memory the live fibers take, in bytes: their PCBs, and the images
+ * holding the stack and context each was using when it was last
+ * copied off the shared stack of its cpu.  image_used of the
+ * image_bytes hold stack and context.  The shared stacks are not
+ * counted.
+ */
+struct cx_fiber_mem
+{
+    u32     fibers;
+    u32     pcb_bytes;
+    u32     image_bytes;
+    u32     image_used;
+};
+
+/*****************************************************************
+ * Prototypes
+ */
 i32   cx_getpid( void );
 i32   cx_thread_end( i32      pid );
 i32   cx_findproc( const char  *name );
@@ -41,6 +95,52 @@ i32   cx_thread_start( char       *name,
                        u32      stacksize,
                        void       (*fnc)(i32   arg),
                        i32     arg );
+i32   cx_thread_start_prio( char       *name,
+                            u8      *stack,
+                            u32      stacksize,
+                            void       (*fnc)(i32   arg),
+                            i32     arg,
+                            u32     prio );
+i32   cx_fiber_start( char       *name,
+                      void       (*fnc)(i32   arg),
+                      i32     arg );
+i32   cx_fiber_mem( struct cx_fiber_mem *mem );
+i32   cx_thread_setprio( i32 pid, u32 prio );
+i32   cx_thread_getprio( i32 pid );
+i32   cx_thread_setweight( i32 pid, u32 weight );
+i32   cx_thread_getweight( i32 pid );
+i32   cx_thread_join( i32 pid, i32 *status );
+void  cx_thread_exit( i32 status );
+i32   cx_thread_set_periodic( i32 pid,
+                              u32 period,
+                              u32 budget,
+                              u32 deadline );
+i32   cx_thread_wait_period( void );
+i32   cx_group_create( const char *name,
+                       u32 period,
+                       u32 quota,
+                       u32 mem_limit );
+i32   cx_group_destroy( i32 gid );
+i32   cx_thread_setgroup( i32 pid, i32 gid );
+i32   cx_thread_getgroup( i32 pid );
+i32   cx_thread_latency( i32 pid, struct cx_lat *lat );
+i32   cx_tls_key_create( void (*destructor)(void *value) );
+i32   cx_tls_key_delete( i32 key );
+i32   cx_tls_set( i32 key, void *value );
+void *cx_tls_get( i32 key );
 i32   cx_yield( void );
+i32   cx_yield_to( i32 pid );
+i32   cx_idle_register( const char *name,
+                        i32 (*fn)(void *arg),
+                        void *arg );
+i32   cx_idle_unregister( i32 id );
+i32   cx_idle_kick( i32 id );
+void  cx_preempt_set( u32 msecs );
+u32   cx_preempt_get( void );
+void  cx_stack_check_set( u32 on );
+u32   cx_stack_check_get( void );
+void  cx_stack_margin_set( u32 bytes );
+u32   cx_stack_margin_get( void );
+i32   cx_thread_stack_used( i32 pid );
 
 #endif /* _CX_PROC_H */
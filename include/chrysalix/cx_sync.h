@@ -40,12 +40,14 @@
  * Structures
  */
 /*
- * Semaphore interface
+ * Semaphore interface.  Threads wait on sem_q and tasks on
+ * sem_tasks; a post wakes a thread before a task.
  */
 struct semaphore
 {
     i32          value;
     struct queue        sem_q;
+    struct queue        sem_tasks;
 };
 
 struct mutex
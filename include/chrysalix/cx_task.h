@@ -0,0 +1,169 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+ 
+#ifndef _CX_TASK_H
+#define _CX_TASK_H
+
+/*****************************************************************
+ * Defines
+ */
+    /** Returned by a task function that is waiting for something */
+#define CX_TASK_PENDING     (-1)
+    /** Returned by a task function that is done */
+#define CX_TASK_DONE        0
+
+    /** Messages a mailbox holds for tasks that are not waiting */
+#define CX_MBOX_SIZE        8
+
+/**
+ * Tasks.  A task function is written between CX_TASK_BEGIN() and
+ * CX_TASK_END(), and waits with the CX_TASK_ macros below.  A wait
+ * returns from the function; when the task runs again the function
+ * is called anew and carries on right after the wait.  So the
+ * locals of the function do not live across a wait: keep what has
+ * to in the structure the task is part of.  A wait cannot be inside
+ * a switch statement of its own.
+ * @{
+ */
+#define CX_TASK_BEGIN(task) \
+    switch ((task)->tk_line) { \
+    case 0:
+
+#define CX_TASK_END(task) \
+    } \
+    (task)->tk_line = 0; \
+    return (CX_TASK_DONE)
+
+    /** Let the other tasks that are ready run first */
+#define CX_TASK_YIELD(task) \
+    do { \
+        (task)->tk_line = __LINE__; \
+        cx_task_ready(task); \
+        return (CX_TASK_PENDING); \
+    case __LINE__:; \
+    } while (0)
+
+    /** Wait @p msecs */
+#define CX_TASK_SLEEP(task, msecs) \
+    do { \
+        (task)->tk_line = __LINE__; \
+        cx_task_sleep((task), (msecs)); \
+        return (CX_TASK_PENDING); \
+    case __LINE__:; \
+    } while (0)
+
+    /** Take the semaphore @p sem, waiting until it is posted */
+#define CX_TASK_AWAIT_SEM(task, sem) \
+    do { \
+        (task)->tk_line = __LINE__; \
+        __attribute__ ((fallthrough)); \
+    case __LINE__: \
+        if (0 != cx_task_sem_wait((task), (sem))) \
+            return (CX_TASK_PENDING); \
+    } while (0)
+
+    /** Receive a message from the mailbox @p mbox into @p msg */
+#define CX_TASK_AWAIT_MSG(task, mbox, msg) \
+    do { \
+        (task)->tk_line = __LINE__; \
+        __attribute__ ((fallthrough)); \
+    case __LINE__: \
+        if (0 != cx_task_msg_recv((task), (mbox), (msg))) \
+            return (CX_TASK_PENDING); \
+    } while (0)
+
+    /**
+     * Wait for the next cx_event_post() of @p val, such as the
+     * TTY_EVENT_RX a tty posts when input comes in
+     */
+#define CX_TASK_AWAIT_EVENT(task, val) \
+    do { \
+        (task)->tk_line = __LINE__; \
+        __attribute__ ((fallthrough)); \
+    case __LINE__: \
+        if (0 != cx_task_event_wait((task), (val))) \
+            return (CX_TASK_PENDING); \
+    } while (0)
+/** @} */
+
+/*****************************************************************
+ * Structures
+ */
+
+/**
+ * Task.  It has no stack; the executor thread calls its function
+ * each time it is ready to run.  The caller provides the structure,
+ * and it must stay put until the task is done.
+ */
+struct cx_task
+{
+    i32                 (*tk_fn)(struct cx_task *task);
+    void               *tk_arg;
+    u32                 tk_line;
+    u32                 tk_state;
+    u32                 tk_granted;
+    u32                 tk_runs;
+    u64                 tk_wake;
+    u32                 tk_event;
+    struct msg         *tk_msg;
+    struct queue        tk_link;
+    struct pqueue_node  tk_sleep_node;
+    struct queue        tk_joiners;
+};
+
+/**
+ * Mailbox.  Messages are copied in and out, so the sender may reuse
+ * its message as soon as it is posted.
+ */
+struct cx_mbox
+{
+    struct msg          mb_msgs[CX_MBOX_SIZE];
+    u32                 mb_head;
+    u32                 mb_count;
+    struct queue        mb_tasks;
+};
+
+/*****************************************************************
+ * Prototypes
+ */
+i32   cx_task_start( struct cx_task *task,
+                     i32 (*fn)(struct cx_task *task),
+                     void *arg );
+i32   cx_task_join( struct cx_task *task );
+void  cx_task_ready( struct cx_task *task );
+void  cx_task_sleep( struct cx_task *task, u32 msecs );
+i32   cx_task_sem_wait( struct cx_task *task, struct semaphore *sem );
+i32   cx_task_msg_recv( struct cx_task *task,
+                        struct cx_mbox *mbox,
+                        struct msg *msg );
+i32   cx_task_event_wait( struct cx_task *task, u32 val );
+i32   cx_mbox_init( struct cx_mbox *mbox );
+i32   cx_mbox_post( struct cx_mbox *mbox, struct msg *msg );
+
+#endif /* _CX_TASK_H */
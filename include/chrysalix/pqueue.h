@@ -0,0 +1,61 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * pqueue.h - intrusive priority queue (pairing heap) definition
+ */
+#ifndef _PQUEUE_H
+#define _PQUEUE_H
+
+struct pqueue_node {
+	struct pqueue_node *child;	/* first child */
+	struct pqueue_node *next;	/* next sibling */
+	struct pqueue_node *prev;	/* previous sibling, or parent */
+};
+
+struct pqueue {
+	struct pqueue_node *root;
+	/* Return < 0 when a must come out of the queue before b */
+	int (*cmp)(struct pqueue_node *a, struct pqueue_node *b);
+};
+
+#define pqueue_empty(pq)	((pq)->root == (struct pqueue_node *) 0)
+#define pqueue_first(pq)	((pq)->root)
+
+/* Get the struct for this entry */
+#define pqueue_entry(n, type, member) \
+    ((type *)((char *)(n) - (unsigned long)(&((type *)0)->member)))
+
+extern void pqueue_init(struct pqueue *pq,
+			int (*cmp)(struct pqueue_node *a, struct pqueue_node *b));
+extern void pqueue_insert(struct pqueue *pq, struct pqueue_node *node);
+extern struct pqueue_node *pqueue_remove_first(struct pqueue *pq);
+extern void pqueue_remove(struct pqueue *pq, struct pqueue_node *node);
+
+#endif	/* _PQUEUE_H */
@@ -0,0 +1,61 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _ARCH_CONTEXT_H
+#define _ARCH_CONTEXT_H
+
+/*
+ * arch_context.h - Architecture dependent definitions
+ *
+ * fastctx keeps the whole register state of a suspended thread on
+ * its own stack, so the context only has to remember where that is.
+ */
+
+#include <stddef.h>
+
+/****************************************************************************/
+void linux_entry_point_setup( void );
+u64 linux_get_mtime( void );
+u64 linux_get_usecs( void );
+u64 linux_get_cpu_usecs( void );
+int linux_cpu_wakefd( void );
+void linux_cpu_drain( void );
+void linux_cpu_idle( i32 timeout );
+void fastctx_switch( void **prev_sp, void *next_sp );
+
+/*
+ * Saved stack pointer
+ */
+struct context
+{
+     void *sp;
+};
+
+
+#endif /* _ARCH_CONTEXT_H */
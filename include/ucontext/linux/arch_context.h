@@ -46,6 +46,11 @@
 /****************************************************************************/
 void linux_entry_point_setup( void );
 u64 linux_get_mtime( void );
+u64 linux_get_usecs( void );
+u64 linux_get_cpu_usecs( void );
+int linux_cpu_wakefd( void );
+void linux_cpu_drain( void );
+void linux_cpu_idle( i32 timeout );
 
 /*
  * Userspace context
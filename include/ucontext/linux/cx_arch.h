@@ -33,11 +33,67 @@
 /*****************************************************************
  * Defines
  */
-    /** Maximum thread name */
-#define ARCH_MAX_THREAD_NAME     8
+    /** Maximum thread name, longer names are cut short */
+#define ARCH_MAX_THREAD_NAME     31
 
-    /** Maximum number of threads allowed */
-#define ARCH_MAX_THREADS         64
+    /**
+     * Maximum number of threads allowed.  Their PCBs are allocated
+     * as they are needed.
+     */
+#define ARCH_MAX_THREADS         (128*1024)
+
+    /**
+     * Maximum number of fibers allowed, apart from the threads.
+     * Their PCBs are allocated as they are needed.
+     */
+#define ARCH_MAX_FIBERS          (1024*1024)
+
+    /**
+     * Number of virtual cpus, each one a host thread.  Set with
+     * CX_NCPU=n on the make command line.
+     */
+#ifndef ARCH_NCPUS
+#define ARCH_NCPUS               1
+#endif
+
+    /**
+     * Storage class of variables the kernel keeps for each cpu.
+     * Every cpu is a host thread, so they are thread local.
+     */
+#if ARCH_NCPUS > 1
+#define ARCH_CPU_LOCAL           __thread
+#else
+#define ARCH_CPU_LOCAL
+#endif
+
+    /**
+     * Time slice in msecs of cpu time after which a running thread
+     * is preempted, 0 to switch only when threads yield.  Set with
+     * CX_PREEMPT=msecs on the make command line, or at run time
+     * with the preempt console command.
+     */
+#ifndef ARCH_PREEMPT_MSECS
+#define ARCH_PREEMPT_MSECS       0
+#endif
+
+    /**
+     * Fill the stacks of new threads with a pattern so that ps and
+     * pdump can show the most of them each thread has used.  Every
+     * page of the stack is touched.  Set with CX_STACKCHECK=1 on the
+     * make command line, or at run time with the stacks console
+     * command.
+     */
+#ifndef ARCH_STACK_CHECK
+#define ARCH_STACK_CHECK         0
+#endif
+
+    /**
+     * A thread whose stack is checked is warned about when it comes
+     * within this many bytes of the end of its stack
+     */
+#ifndef ARCH_STACK_MARGIN
+#define ARCH_STACK_MARGIN        (2*1024)
+#endif
 
     /** Console command line size */
 #define ARCH_CMDLINE_SIZE   128
@@ -45,6 +101,15 @@
     /** Minimum stack for this architecture */
 #define ARCH_MIN_STACK_SIZE         (16*1024)
 
+    /**
+     * Size of the stack the fibers of a cpu share.  A power of two
+     * of at least ARCH_MIN_STACK_SIZE.
+     */
+#define ARCH_FIBER_STACK_SIZE       (64*1024)
+
+    /** Stack of the thread that runs all the tasks */
+#define ARCH_TASK_STACK_SIZE        (64*1024)
+
     /** 
      * Maximum number of global file descriptors allowed in 
      * the system
@@ -57,6 +122,18 @@
      */
 #define ARCH_MAX_DRIVERS     10
 
+    /** Maximum number of thread groups, counting the root group */
+#define ARCH_MAX_GROUPS      16
+
+    /** Number of thread-local storage keys, each a slot in every PCB */
+#define ARCH_MAX_TLS_KEYS    8
+
+    /** Maximum number of idle hooks */
+#define ARCH_MAX_IDLE_HOOKS  8
+
+    /** Bytes in a cache line of the host */
+#define ARCH_CACHE_LINE      64
+
     /**
      * Maximum size for the device driver name
      */
@@ -34,8 +34,18 @@
  * tty_ioctl functions
  */
 
+    /** Event posted when there is input ready */
+#define TTY_EVENT_RX        (0x74747900)
+
+    /**
+     * While waiting for input, how often a reader checks for it
+     * in case the system is too busy to go idle
+     */
+#define TTY_POLL_MSECS      50
+
 /**************** API **************************/
 
 i32 tty_init( drv_t  minor );
+void tty_idle( i32  timeout );
 
 #endif /* _CX_TTY_DRV_H */
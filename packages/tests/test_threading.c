@@ -36,9 +36,66 @@
 // Prototypes
 void add(i32 arg);
 void test_sync(void);
+void record(i32 arg);
+void test_prio(void);
+void nap(i32 arg);
+void test_sleep(void);
+void bump(i32 arg);
+void test_contend(void);
+void spin(i32 arg);
+void test_preempt(void);
+void many(i32 arg);
+void test_many(void);
+void deep(i32 arg);
+void test_stack(void);
+void idle(i32 arg);
+void test_names(void);
+void job(i32 arg);
+void test_join(void);
+void periodic(i32 arg);
+void hog(i32 arg);
+void test_edf(void);
+void share(i32 arg);
+void test_fair(void);
+void burn(i32 arg);
+void test_groups(void);
+void napper(i32 arg);
+void test_latency(void);
+void keep(i32 arg);
+void hold(i32 arg);
+void drop(void *value);
+void test_tls(void);
+void handed(i32 arg);
+void test_yield_to(void);
+i32 idler(void *arg);
+void test_idle(void);
+void fiber(i32 arg);
+u32 fiber_work(i32 arg, u32 depth);
+void test_fibers(void);
+i32 summer(struct cx_task *task);
+i32 sleeper(struct cx_task *task);
+i32 listener(struct cx_task *task);
+void test_tasks(void);
 
 void test_threading(void) {
     test_sync();
+    test_prio();
+    test_sleep();
+    test_contend();
+    test_preempt();
+    test_many();
+    test_stack();
+    test_names();
+    test_join();
+    test_edf();
+    test_fair();
+    test_groups();
+    test_latency();
+    test_tls();
+    test_yield_to();
+    test_idle();
+    test_fibers();
+    test_tasks();
 }
 
 // Global test value
@@ -77,3 +134,1053 @@ void add(i32 arg) {
     // Tell the test program to go ahead and finish
     waitgroup_done(&test_sync_wait);
 }
+
+// Order in which the threads of test_prio ran
+i32 prio_order[2];
+i32 prio_count;
+struct waitgroup test_prio_wait;
+
+// Protects the order arrays, threads may finish on different cpus
+struct mutex order_lock;
+
+void test_prio(void) {
+    printf("test_prio...");
+    prio_count = 0;
+    waitgroup_init(&test_prio_wait, 2);
+    mutex_init(&order_lock);
+
+    // Start the low priority thread first
+    cx_thread_start_prio("test_lo", NULL, STACK_SIZE, record, 2,
+                         CX_PRIO_LOWEST);
+    cx_thread_start_prio("test_hi", NULL, STACK_SIZE, record, 1,
+                         CX_PRIO_HIGHEST);
+
+    waitgroup_wait(&test_prio_wait);
+
+    // To pass, the high priority thread must have run first.  With
+    // several cpus the low one starts on another cpu right away, so
+    // only check that both ran.
+    if ((2 != prio_count) ||
+        ((1 == ARCH_NCPUS) &&
+         ((1 != prio_order[0]) || (2 != prio_order[1])))) {
+        printf("FAILED, order was %d %d\n", prio_order[0], prio_order[1]);
+    } else {
+        printf("OK\n");
+    }
+}
+
+void record(i32 arg) {
+    mutex_lock(&order_lock);
+    prio_order[prio_count++] = arg;
+    mutex_unlock(&order_lock);
+    waitgroup_done(&test_prio_wait);
+}
+
+// Order in which the threads of test_sleep woke up
+i32 sleep_order[3];
+i32 sleep_count;
+struct waitgroup test_sleep_wait;
+
+void test_sleep(void) {
+    printf("test_sleep...");
+    sleep_count = 0;
+    waitgroup_init(&test_sleep_wait, 3);
+
+    cx_thread_start("test_nap1", NULL, STACK_SIZE, nap, 30);
+    cx_thread_start("test_nap2", NULL, STACK_SIZE, nap, 10);
+    cx_thread_start("test_nap3", NULL, STACK_SIZE, nap, 20);
+
+    waitgroup_wait(&test_sleep_wait);
+
+    // To pass, the threads must wake up shortest sleep first
+    if ((3 != sleep_count) || (10 != sleep_order[0]) ||
+        (20 != sleep_order[1]) || (30 != sleep_order[2])) {
+        printf("FAILED, order was %d %d %d\n",
+               sleep_order[0], sleep_order[1], sleep_order[2]);
+    } else {
+        printf("OK\n");
+    }
+}
+
+void nap(i32 arg) {
+    cx_msleep(arg);
+    mutex_lock(&order_lock);
+    sleep_order[sleep_count++] = arg;
+    mutex_unlock(&order_lock);
+    waitgroup_done(&test_sleep_wait);
+}
+
+// Threads of test_contend all add to the same counter
+#define CONTEND_THREADS 4
+#define CONTEND_LOOPS   1000
+i32 contend_total;
+struct mutex contend_lock;
+struct waitgroup test_contend_wait;
+
+void test_contend(void) {
+    i32 i;
+
+    printf("test_contend...");
+    contend_total = 0;
+    mutex_init(&contend_lock);
+    waitgroup_init(&test_contend_wait, CONTEND_THREADS);
+
+    for (i = 0; i < CONTEND_THREADS; i++)
+        cx_thread_start("test_bump", NULL, STACK_SIZE, bump, CONTEND_LOOPS);
+
+    waitgroup_wait(&test_contend_wait);
+
+    // To pass, no increment may be lost
+    if (CONTEND_THREADS * CONTEND_LOOPS != contend_total) {
+        printf("FAILED, total is %d\n", contend_total);
+    } else {
+        printf("OK\n");
+    }
+}
+
+void bump(i32 arg) {
+    i32 value;
+
+    while (arg--) {
+        mutex_lock(&contend_lock);
+        value = contend_total;
+        cx_yield();
+        contend_total = value + 1;
+        mutex_unlock(&contend_lock);
+    }
+    waitgroup_done(&test_contend_wait);
+}
+
+// Threads of test_preempt never yield.  There is one more of them than
+// there are cpus, so the test thread only runs again if they are
+// preempted.  They run for at least PREEMPT_MSECS, and on until each
+// has been seen to run or PREEMPT_WAIT msecs have gone by, since how
+// fast the ticks come depends on how the host runs the cpus.
+#define PREEMPT_THREADS (ARCH_NCPUS + 1)
+#define PREEMPT_MSECS   50
+#define PREEMPT_WAIT    2000
+i32 preempt_total;
+volatile i32 preempt_spins[PREEMPT_THREADS];
+volatile i32 preempt_stop;
+struct mutex preempt_lock;
+struct waitgroup test_preempt_wait;
+
+void test_preempt(void) {
+    i32 i;
+    i32 sum;
+    i32 waited;
+    u32 quantum;
+
+    printf("test_preempt...");
+    quantum = cx_preempt_get();
+    cx_preempt_set(2);
+    preempt_total = 0;
+    preempt_stop = 0;
+    mutex_init(&preempt_lock);
+    waitgroup_init(&test_preempt_wait, PREEMPT_THREADS);
+
+    for (i = 0; i < PREEMPT_THREADS; i++) {
+        preempt_spins[i] = 0;
+        cx_thread_start("test_spn", NULL, STACK_SIZE, spin, i);
+    }
+
+    cx_msleep(PREEMPT_MSECS);
+    for (waited = PREEMPT_MSECS; waited < PREEMPT_WAIT; waited += 10) {
+        for (i = 0; (i < PREEMPT_THREADS) && (0 != preempt_spins[i]); i++);
+        if (PREEMPT_THREADS == i)
+            break;
+        cx_msleep(10);
+    }
+    preempt_stop = 1;
+    waitgroup_wait(&test_preempt_wait);
+    cx_preempt_set(quantum);
+
+    // To pass, every thread must have run, and no increment made
+    // under the mutex may be lost
+    sum = 0;
+    for (i = 0; i < PREEMPT_THREADS; i++) {
+        if (0 == preempt_spins[i]) {
+            printf("FAILED, thread %d never ran\n", i);
+            return;
+        }
+        sum += preempt_spins[i];
+    }
+    if (sum != preempt_total) {
+        printf("FAILED, total is %d of %d\n", preempt_total, sum);
+    } else {
+        printf("OK\n");
+    }
+}
+
+void spin(i32 arg) {
+    while (!preempt_stop) {
+        mutex_lock(&preempt_lock);
+        preempt_total++;
+        mutex_unlock(&preempt_lock);
+        preempt_spins[arg]++;
+    }
+    waitgroup_done(&test_preempt_wait);
+}
+
+// test_many runs more threads at once than the old fixed table of 64
+// held, with more stack between them than the OS heap has
+#define MANY_THREADS    500
+struct waitgroup test_many_wait;
+
+void test_many(void) {
+    i32 i;
+    i32 pid;
+    char name[ARCH_MAX_THREAD_NAME + 1];
+
+    printf("test_many...");
+    waitgroup_init(&test_many_wait, MANY_THREADS);
+
+    for (i = 0; i < MANY_THREADS; i++) {
+        pid = cx_thread_start("test_man", NULL, STACK_SIZE, many, 10);
+        if (0 > pid) {
+            printf("FAILED, thread %d did not start\n", i);
+            return;
+        }
+        if ((0 != cx_findname(pid, name, sizeof(name))) ||
+            (0 != strncmp(name, "test_man", sizeof(name)))) {
+            printf("FAILED, pid %d not found\n", pid);
+            return;
+        }
+    }
+
+    waitgroup_wait(&test_many_wait);
+    printf("OK\n");
+}
+
+void many(i32 arg) {
+    cx_msleep(arg);
+    waitgroup_done(&test_many_wait);
+}
+
+// test_stack has a thread use a known amount of its stack and checks
+// that at least that much is reported used
+#define DEEP_BYTES      (4*1024)
+volatile i32 deep_done;
+volatile i32 deep_stop;
+i32 deep_sum;
+
+void test_stack(void) {
+    i32 pid;
+    i32 used;
+    u32 check;
+
+    printf("test_stack...");
+    check = cx_stack_check_get();
+    cx_stack_check_set(1);
+    deep_done = 0;
+    deep_stop = 0;
+    pid = cx_thread_start("test_dep", NULL, STACK_SIZE, deep, DEEP_BYTES);
+    cx_stack_check_set(check);
+    if (0 > pid) {
+        printf("FAILED, thread did not start\n");
+        return;
+    }
+
+    while (!deep_done)
+        cx_msleep(1);
+    used = cx_thread_stack_used(pid);
+    deep_stop = 1;
+
+    if ((DEEP_BYTES > used) || (STACK_SIZE < used)) {
+        printf("FAILED, %d bytes used\n", used);
+    } else {
+        printf("OK\n");
+    }
+}
+
+void deep(i32 arg) {
+    volatile u8 buf[DEEP_BYTES];
+    i32 i;
+
+    // Write every byte, then read it back so none of it is left out
+    for (i = 0; i < arg; i++)
+        buf[i] = (u8) i;
+    for (i = 0; i < arg; i++)
+        deep_sum += buf[i];
+    deep_done = 1;
+    while (!deep_stop)
+        cx_msleep(1);
+}
+
+// test_names starts threads sharing a name longer than the old limit
+// of 8 and checks the oldest live one is found as they end
+#define NAMES_THREADS   3
+#define NAMES_NAME      "test_names_long"
+
+void test_names(void) {
+    i32 i;
+    i32 pids[NAMES_THREADS];
+    i32 pid;
+    char name[ARCH_MAX_THREAD_NAME + 1];
+
+    printf("test_names...");
+    for (i = 0; i < NAMES_THREADS; i++) {
+        pids[i] = cx_thread_start(NAMES_NAME, NULL, STACK_SIZE, idle, 0);
+        if (0 > pids[i]) {
+            printf("FAILED, thread %d did not start\n", i);
+            return;
+        }
+    }
+
+    if ((0 != cx_findname(pids[0], name, sizeof(name))) ||
+        (0 != strncmp(name, NAMES_NAME, sizeof(name)))) {
+        printf("FAILED, name is %s\n", name);
+        return;
+    }
+
+    for (i = 0; i < NAMES_THREADS; i++) {
+        pid = cx_findproc(NAMES_NAME);
+        if (pid != pids[i]) {
+            printf("FAILED, found %d instead of %d\n", pid, pids[i]);
+            return;
+        }
+        cx_thread_end(pids[i]);
+    }
+
+    if (-ENOENT != cx_findproc(NAMES_NAME)) {
+        printf("FAILED, ended threads still found\n");
+        return;
+    }
+    printf("OK\n");
+}
+
+void idle(i32 arg _UNUSED_) {
+    while (1)
+        cx_msleep(1000);
+}
+
+// test_join fans work out to threads that exit with a status of their
+// own, and waits for each of them.  Odd ones return from their entry
+// function instead, which exits with 0.
+#define JOIN_THREADS    8
+
+void test_join(void) {
+    i32 i;
+    i32 pids[JOIN_THREADS];
+    i32 pid;
+    i32 status;
+
+    printf("test_join...");
+    for (i = 0; i < JOIN_THREADS; i++) {
+        pids[i] = cx_thread_start("test_job", NULL, STACK_SIZE, job, i);
+        if (0 > pids[i]) {
+            printf("FAILED, thread %d did not start\n", i);
+            return;
+        }
+    }
+
+    for (i = 0; i < JOIN_THREADS; i++) {
+        if ((0 != cx_thread_join(pids[i], &status)) ||
+            (status != ((i & 1) ? 0 : 100 + i))) {
+            printf("FAILED, thread %d exited with %d\n", i, status);
+            return;
+        }
+    }
+
+    // Waiting again for one that has ended gets the same status
+    if ((0 != cx_thread_join(pids[0], &status)) || (100 != status)) {
+        printf("FAILED, status of ended thread is %d\n", status);
+        return;
+    }
+
+    // A thread ended by another
+    pid = cx_thread_start("test_job", NULL, STACK_SIZE, idle, 0);
+    cx_thread_end(pid);
+    if ((0 != cx_thread_join(pid, &status)) || (CX_EXIT_ENDED != status)) {
+        printf("FAILED, status of killed thread is %d\n", status);
+        return;
+    }
+
+    if ((-1 != cx_thread_join(cx_getpid(), NULL)) || (EDEADLK != errno)) {
+        printf("FAILED, waited for itself\n");
+        return;
+    }
+    printf("OK\n");
+}
+
+void job(i32 arg) {
+    cx_msleep(1 + arg);
+    if (0 == (arg & 1))
+        cx_thread_exit(100 + arg);
+}
+
+// test_edf runs a periodic thread at the lowest priority next to a
+// thread that never stops running at a higher one.  Only the
+// deadline class lets it do its jobs.  It gets EDF_WAIT periods to
+// do EDF_JOBS, so a host slow to run the cpus does not fail it.
+#define EDF_PERIOD      5
+#define EDF_BUDGET      2
+#define EDF_JOBS        10
+#define EDF_WAIT        (EDF_JOBS * 40)
+volatile i32 edf_jobs;
+volatile i32 edf_stop;
+
+void test_edf(void) {
+    i32 pid;
+    i32 hogpid;
+    i32 pids[ARCH_NCPUS + 1];
+    i32 i;
+
+    printf("test_edf...");
+    edf_jobs = 0;
+    edf_stop = 0;
+    hogpid = cx_thread_start("test_hog", NULL, STACK_SIZE, hog, 0);
+    pid = cx_thread_start_prio("test_per", NULL, STACK_SIZE, periodic, 0,
+                               CX_PRIO_LOWEST);
+    if ((0 > hogpid) || (0 > pid)) {
+        printf("FAILED, threads did not start\n");
+        return;
+    }
+    if (0 != cx_thread_set_periodic(pid, EDF_PERIOD, EDF_BUDGET, 0)) {
+        printf("FAILED, not admitted\n");
+        return;
+    }
+
+    for (i = 0; (i < EDF_WAIT) && (EDF_JOBS > edf_jobs); i++)
+        cx_msleep(EDF_PERIOD);
+    edf_stop = 1;
+    cx_thread_join(pid, NULL);
+    cx_thread_join(hogpid, NULL);
+    if (EDF_JOBS > edf_jobs) {
+        printf("FAILED, %d jobs done\n", edf_jobs);
+        return;
+    }
+
+    // Every cpu has room for one thread using more than half of it
+    if ((-1 != cx_thread_set_periodic(cx_getpid(), 10, 11, 0)) ||
+        (EINVAL != errno)) {
+        printf("FAILED, budget over the period accepted\n");
+        return;
+    }
+    for (i = 0; i < ARCH_NCPUS + 1; i++) {
+        pids[i] = cx_thread_start("test_per", NULL, STACK_SIZE, idle, 0);
+        if (0 != cx_thread_set_periodic(pids[i], 10, 6, 0))
+            break;
+    }
+    for (pid = 0; pid <= i; pid++)
+        cx_thread_end(pids[pid]);
+    if ((ARCH_NCPUS != i) || (EBUSY != errno)) {
+        printf("FAILED, %d admitted\n", i);
+        return;
+    }
+    printf("OK\n");
+}
+
+void periodic(i32 arg _UNUSED_) {
+    while (!edf_stop) {
+        edf_jobs++;
+        cx_thread_wait_period();
+    }
+}
+
+void hog(i32 arg _UNUSED_) {
+    while (!edf_stop)
+        cx_yield();
+}
+
+// test_fair runs two threads that do the same work, one with three
+// times the weight of the other.  On one cpu it must get about three
+// times as much done.
+#define FAIR_WEIGHT     (3 * CX_WEIGHT_DEFAULT)
+volatile u32 fair_spins[2];
+volatile i32 fair_stop;
+
+void test_fair(void) {
+    i32 pids[2];
+    i32 i;
+    u32 ratio;
+
+    printf("test_fair...");
+    fair_stop = 0;
+    for (i = 0; i < 2; i++) {
+        fair_spins[i] = 0;
+        pids[i] = cx_thread_start("test_shr", NULL, STACK_SIZE, share, i);
+        if (0 > pids[i]) {
+            printf("FAILED, thread %d did not start\n", i);
+            return;
+        }
+    }
+    if ((0 != cx_thread_setweight(pids[1], FAIR_WEIGHT)) ||
+        (FAIR_WEIGHT != cx_thread_getweight(pids[1]))) {
+        printf("FAILED, weight not set\n");
+        return;
+    }
+
+    cx_msleep(200);
+    fair_stop = 1;
+    cx_thread_join(pids[0], NULL);
+    cx_thread_join(pids[1], NULL);
+
+    if ((0 == fair_spins[0]) || (0 == fair_spins[1])) {
+        printf("FAILED, a thread never ran\n");
+        return;
+    }
+
+    // With more cpus they each get one
+    ratio = fair_spins[1] * 10 / fair_spins[0];
+    if ((1 == ARCH_NCPUS) && ((ratio < 20) || (ratio > 45))) {
+        printf("FAILED, ratio is %u.%u\n", ratio / 10, ratio % 10);
+        return;
+    }
+    printf("OK\n");
+}
+
+void share(i32 arg) {
+    volatile u32 i;
+
+    // Enough work each time round that switching costs little
+    while (!fair_stop) {
+        for (i = 0; i < 10000; i++);
+        fair_spins[arg]++;
+        cx_yield();
+    }
+}
+
+// test_groups puts a thread in a group allowed a fifth of a cpu next
+// to one in the root group doing the same work.  The thread in the
+// group must get much less done.  The group also has a heap limit.
+#define GRP_PERIOD      20
+#define GRP_QUOTA       4
+#define GRP_MEM         1024
+volatile u32 grp_spins[2];
+volatile i32 grp_stop;
+
+void test_groups(void) {
+    i32 gid;
+    i32 pids[2];
+    void *mem;
+    i32 i;
+
+    printf("test_groups...");
+    grp_stop = 0;
+    grp_spins[0] = grp_spins[1] = 0;
+    gid = cx_group_create("test_grp", GRP_PERIOD, GRP_QUOTA, GRP_MEM);
+    if (0 > gid) {
+        printf("FAILED, group not created\n");
+        return;
+    }
+
+    // Memory taken in the group counts against its limit
+    if ((0 != cx_thread_setgroup(cx_getpid(), gid)) ||
+        (gid != cx_thread_getgroup(cx_getpid()))) {
+        printf("FAILED, not moved to the group\n");
+        return;
+    }
+    mem = cx_kmalloc(GRP_MEM / 2, KM_NOCXEEP);
+    if ((NULL == mem) ||
+        (NULL != cx_kmalloc(GRP_MEM, KM_NOCXEEP)) || (ENOMEM != errno)) {
+        printf("FAILED, heap limit not kept\n");
+        return;
+    }
+    if ((-1 != cx_group_destroy(gid)) || (EBUSY != errno)) {
+        printf("FAILED, group in use destroyed\n");
+        return;
+    }
+    cx_kfree(mem);
+
+    // New threads join the group of the thread starting them
+    pids[1] = cx_thread_start("test_grp", NULL, STACK_SIZE, burn, 1);
+    cx_thread_setgroup(cx_getpid(), 0);
+    pids[0] = cx_thread_start("test_grp", NULL, STACK_SIZE, burn, 0);
+    if ((0 > pids[0]) || (0 > pids[1])) {
+        printf("FAILED, threads did not start\n");
+        return;
+    }
+    if ((gid != cx_thread_getgroup(pids[1])) ||
+        (0 != cx_thread_getgroup(pids[0]))) {
+        printf("FAILED, group not inherited\n");
+        return;
+    }
+
+    cx_msleep(10 * GRP_PERIOD);
+    grp_stop = 1;
+    for (i = 0; i < 2; i++)
+        cx_thread_join(pids[i], NULL);
+
+    if ((0 == grp_spins[1]) || (grp_spins[1] * 2 > grp_spins[0])) {
+        printf("FAILED, %u and %u spins\n", grp_spins[0], grp_spins[1]);
+        return;
+    }
+    if (0 != cx_group_destroy(gid)) {
+        printf("FAILED, group not destroyed\n");
+        return;
+    }
+    printf("OK\n");
+}
+
+void burn(i32 arg) {
+    volatile u32 i;
+
+    while (!grp_stop) {
+        for (i = 0; i < 10000; i++);
+        grp_spins[arg]++;
+        cx_yield();
+    }
+}
+
+// test_latency has a thread sleep over and over, each time being
+// woken up by its sleep ending, and checks the waits were counted
+#define LAT_NAPS        20
+volatile i32 lat_naps;
+
+void test_latency(void) {
+    struct cx_lat lat;
+    i32 pid;
+
+    printf("test_latency...");
+    lat_naps = 0;
+    pid = cx_thread_start("test_lat", NULL, STACK_SIZE, napper, 0);
+    if (0 > pid) {
+        printf("FAILED, thread did not start\n");
+        return;
+    }
+    while (LAT_NAPS > lat_naps)
+        cx_msleep(5);
+
+    if (0 != cx_thread_latency(pid, &lat)) {
+        printf("FAILED, no latency for pid %d\n", pid);
+        return;
+    }
+    if ((LAT_NAPS > lat.samples) || (lat.p50 > lat.p99) ||
+        (lat.p99 > lat.p999) || (lat.p999 > lat.max)) {
+        printf("FAILED, %u wakeups %u %u %u %u\n", lat.samples, lat.p50,
+               lat.p99, lat.p999, lat.max);
+        return;
+    }
+    cx_thread_end(pid);
+    cx_thread_join(pid, NULL);
+
+    if ((0 != cx_thread_latency(-1, &lat)) || (LAT_NAPS > lat.samples) ||
+        (-1 != cx_thread_latency(pid, &lat)) || (ESRCH != errno)) {
+        printf("FAILED, latency of all threads\n");
+        return;
+    }
+    printf("OK\n");
+}
+
+void napper(i32 arg _UNUSED_) {
+    while (1) {
+        cx_msleep(1);
+        lat_naps++;
+    }
+}
+
+// test_tls has threads each keep their own value under one key and
+// checks the destructor gets each value when its thread returns.  One
+// more thread holds a value and keeps running, on another cpu when
+// there are several, until it is ended; its destructor must not run.
+#define TLS_THREADS     4
+i32 tls_key;
+volatile i32 tls_seen[TLS_THREADS];
+volatile i32 tls_dropped;
+volatile i32 tls_held;
+volatile i32 tls_ended;
+
+void test_tls(void) {
+    i32 pids[TLS_THREADS];
+    i32 pid;
+    i32 status;
+    i32 i;
+
+    printf("test_tls...");
+    tls_dropped = 0;
+    tls_key = cx_tls_key_create(drop);
+    if (0 > tls_key) {
+        printf("FAILED, no key\n");
+        return;
+    }
+    if (NULL != cx_tls_get(tls_key)) {
+        printf("FAILED, new key has a value\n");
+        return;
+    }
+    for (i = 0; i < TLS_THREADS; i++) {
+        tls_seen[i] = -1;
+        pids[i] = cx_thread_start("test_tls", NULL, STACK_SIZE, keep, i);
+    }
+    for (i = 0; i < TLS_THREADS; i++)
+        cx_thread_join(pids[i], NULL);
+
+    for (i = 0; i < TLS_THREADS; i++) {
+        if (i != tls_seen[i]) {
+            printf("FAILED, thread %d saw %d\n", i, tls_seen[i]);
+            return;
+        }
+    }
+    if (((1 << TLS_THREADS) - 1) != tls_dropped) {
+        printf("FAILED, destructors 0x%x\n", tls_dropped);
+        return;
+    }
+
+    tls_held = 0;
+    tls_ended = 0;
+    pid = cx_thread_start("test_tls", NULL, STACK_SIZE, hold, TLS_THREADS);
+    for (i = 0; (i < 500) && (!tls_held); i++)
+        cx_msleep(1);
+    cx_thread_end(pid);
+    tls_ended = 1;
+    if ((0 != cx_thread_join(pid, &status)) || (CX_EXIT_ENDED != status)) {
+        printf("FAILED, status of ended thread is %d\n", status);
+        return;
+    }
+    if ((!tls_held) || (((1 << TLS_THREADS) - 1) != tls_dropped)) {
+        printf("FAILED, ended thread ran destructors 0x%x\n", tls_dropped);
+        return;
+    }
+    if ((0 != cx_tls_key_delete(tls_key)) ||
+        (-1 != cx_tls_set(tls_key, NULL)) || (EINVAL != errno)) {
+        printf("FAILED, key not deleted\n");
+        return;
+    }
+    printf("OK\n");
+}
+
+void keep(i32 arg) {
+    static i32 values[TLS_THREADS];
+
+    values[arg] = arg;
+    cx_tls_set(tls_key, &values[arg]);
+
+    // The others set theirs in the meantime
+    cx_msleep(5);
+    tls_seen[arg] = *(i32 *) cx_tls_get(tls_key);
+}
+
+void hold(i32 arg) {
+    static i32 value;
+
+    value = arg;
+    cx_tls_set(tls_key, &value);
+    tls_held = 1;
+
+    // Keep a cpu of its own, when there are others, until it has
+    // been ended from one of them.  It goes once it gives that up.
+    while (!tls_ended) {
+        if (1 == ARCH_NCPUS)
+            cx_yield();
+    }
+    while (1)
+        cx_yield();
+}
+
+void drop(void *value) {
+    tls_dropped |= 1 << *(i32 *) value;
+}
+
+// test_yield_to hands the cpu to one thread over and over with
+// others waiting at the same level.  On one cpu the thread yielded
+// to must be the one that runs next.
+#define HANDOFF_ROUNDS  100
+#define HANDOFF_OTHERS  4
+volatile i32 handoff_turn;
+volatile i32 handoff_stop;
+volatile u32 handoff_hits;
+
+void test_yield_to(void) {
+    i32 pids[HANDOFF_OTHERS + 1];
+    i32 i;
+
+    printf("test_yield_to...");
+    handoff_turn = 0;
+    handoff_stop = 0;
+    handoff_hits = 0;
+    for (i = 0; i <= HANDOFF_OTHERS; i++) {
+        pids[i] = cx_thread_start("test_hand", NULL, STACK_SIZE, handed, i);
+        if (0 > pids[i]) {
+            printf("FAILED, thread %d did not start\n", i);
+            return;
+        }
+    }
+
+    // Thread 0 is the one handed to
+    for (i = 0; i < HANDOFF_ROUNDS; i++) {
+        handoff_turn = 1;
+        cx_yield_to(pids[0]);
+    }
+    handoff_stop = 1;
+    for (i = 0; i <= HANDOFF_OTHERS; i++)
+        cx_thread_join(pids[i], NULL);
+
+    // A preemption may get in the way now and then
+    if ((1 == ARCH_NCPUS) && (HANDOFF_ROUNDS * 9 / 10 > handoff_hits)) {
+        printf("FAILED, %u of %d handed over\n", handoff_hits,
+               HANDOFF_ROUNDS);
+        return;
+    }
+    if (0 != cx_yield_to(cx_getpid())) {
+        printf("FAILED, yield to self\n");
+        return;
+    }
+    printf("OK\n");
+}
+
+void handed(i32 arg) {
+    while (!handoff_stop) {
+        if (handoff_turn) {
+            handoff_turn = 0;
+            if (0 == arg)
+                handoff_hits++;
+        }
+        cx_yield();
+    }
+}
+
+// test_idle registers an idle hook with a few slices of work and
+// sleeps so the cpu has nothing else to do.  The hook must be
+// called until it is done and not again until it is kicked.
+#define IDLE_SLICES     10
+volatile u32 idle_calls;
+
+void test_idle(void) {
+    i32 id;
+
+    printf("test_idle...");
+    idle_calls = 0;
+    id = cx_idle_register("test_idle", idler, (void *) &idle_calls);
+    if (0 > id) {
+        printf("FAILED, register\n");
+        return;
+    }
+
+    cx_msleep(50);
+    if (IDLE_SLICES != idle_calls) {
+        printf("FAILED, %u calls of %d\n", idle_calls, IDLE_SLICES);
+        cx_idle_unregister(id);
+        return;
+    }
+
+    cx_idle_kick(id);
+    cx_msleep(50);
+    if (IDLE_SLICES + 1 != idle_calls) {
+        printf("FAILED, %u calls after kick\n", idle_calls);
+        cx_idle_unregister(id);
+        return;
+    }
+
+    if ((0 != cx_idle_unregister(id)) || (0 == cx_idle_unregister(id))) {
+        printf("FAILED, unregister\n");
+        return;
+    }
+    printf("OK\n");
+}
+
+i32 idler(void *arg) {
+    volatile u32 *calls = (volatile u32 *) arg;
+
+    (*calls)++;
+    return (IDLE_SLICES > *calls);
+}
+
+// test_fibers starts thousands of fibers that keep values on their
+// stacks, some a few calls deep, while yielding to each other and
+// waiting on a semaphore.  Each must find its values as it left
+// them.  While they all wait, their PCBs must come to no more than
+// FIBER_MAX_PCB a fiber, and their PCBs and images to no more than
+// FIBER_MAX_BYTES.  An image has the context in it, which is a
+// ucontext_t of near 1 KB with ucontext.
+#define FIBER_COUNT     4096
+#define FIBER_ROUNDS    5
+#define FIBER_BYTES     100
+#define FIBER_MAX_PCB   512
+#define FIBER_MAX_BYTES 2560
+struct semaphore fiber_sem;
+volatile u32 fiber_errors;
+i32 fiber_pids[FIBER_COUNT];
+
+void test_fibers(void) {
+    struct cx_fiber_mem mem;
+    i32 status;
+    i32 waiting;
+    i32 i;
+
+    printf("test_fibers...");
+    fiber_errors = 0;
+    sem_init(&fiber_sem, 0);
+    for (i = 0; i < FIBER_COUNT; i++) {
+        fiber_pids[i] = cx_fiber_start("test_fiber", fiber, i);
+        if (0 > fiber_pids[i]) {
+            printf("FAILED, fiber %d did not start\n", i);
+            return;
+        }
+    }
+
+    // Let them all get to the semaphore
+    for (i = 0; i < 500; i++) {
+        sem_getvalue(&fiber_sem, &waiting);
+        if (-FIBER_COUNT == waiting)
+            break;
+        cx_msleep(10);
+    }
+    cx_fiber_mem(&mem);
+    for (i = 0; i < FIBER_COUNT; i++)
+        sem_post(&fiber_sem);
+
+    for (i = 0; i < FIBER_COUNT; i++) {
+        cx_thread_join(fiber_pids[i], &status);
+        if (i != status) {
+            printf("FAILED, fiber %d ended with %d\n", i, status);
+            return;
+        }
+    }
+    if (0 != fiber_errors) {
+        printf("FAILED, %u values lost\n", fiber_errors);
+        return;
+    }
+    if (FIBER_COUNT != mem.fibers) {
+        printf("FAILED, %u fibers counted\n", mem.fibers);
+        return;
+    }
+    if (FIBER_MAX_PCB * FIBER_COUNT < mem.pcb_bytes) {
+        printf("FAILED, %u bytes of PCB a fiber\n",
+               mem.pcb_bytes / FIBER_COUNT);
+        return;
+    }
+    if (FIBER_MAX_BYTES * FIBER_COUNT < mem.pcb_bytes + mem.image_bytes) {
+        printf("FAILED, %u bytes a fiber\n",
+               (mem.pcb_bytes + mem.image_bytes) / FIBER_COUNT);
+        return;
+    }
+    printf("OK\n");
+}
+
+void fiber(i32 arg) {
+    cx_thread_exit((FIBER_ROUNDS == fiber_work(arg, (u32) arg % 4)) ?
+                   arg : -1);
+}
+
+u32 fiber_work(i32 arg, u32 depth) {
+    u8 values[FIBER_BYTES];
+    u32 rounds;
+    u32 i;
+
+    for (i = 0; i < FIBER_BYTES; i++)
+        values[i] = (u8) (arg + depth + i);
+    if (0 != depth) {
+        rounds = fiber_work(arg, depth - 1);
+    } else {
+        for (rounds = 0; rounds < FIBER_ROUNDS; rounds++)
+            cx_yield();
+        sem_wait(&fiber_sem);
+    }
+
+    for (i = 0; i < FIBER_BYTES; i++) {
+        if ((u8) (arg + depth + i) != values[i])
+            fiber_errors++;
+    }
+    return (rounds);
+}
+
+// test_tasks has one task add up the messages posted to a mailbox,
+// more than it holds, while others sleep and yield, then wait on a
+// semaphore.  Then one waits for an event posted over and over.
+// What a task keeps across waits is in its test_task.
+#define TASK_COUNT      256
+#define TASK_MSGS       20
+#define TASK_EVENT      0x7461736b
+#define TASK_EVENTS     2
+struct test_task {
+    struct cx_task task;
+    struct msg msg;
+    i32 sum;
+    u32 i;
+};
+struct test_task tasks[TASK_COUNT];
+struct cx_mbox task_mbox;
+struct semaphore task_sem;
+
+void test_tasks(void) {
+    struct msg msg;
+    i32 i;
+
+    printf("test_tasks...");
+    cx_mbox_init(&task_mbox);
+    sem_init(&task_sem, 0);
+    if ((0 != cx_task_start(&tasks[0].task, summer, NULL)) ||
+        (0 == cx_task_start(NULL, summer, NULL))) {
+        printf("FAILED, start\n");
+        return;
+    }
+    for (i = 1; i < TASK_COUNT; i++)
+        cx_task_start(&tasks[i].task, sleeper, NULL);
+
+    // The mailbox fills up until the task gets to run
+    for (i = 1; i <= TASK_MSGS; i++) {
+        msg.msg_tag = i;
+        while (0 != cx_mbox_post(&task_mbox, &msg))
+            cx_yield();
+    }
+    msg.msg_tag = -1;
+    while (0 != cx_mbox_post(&task_mbox, &msg))
+        cx_yield();
+    cx_task_join(&tasks[0].task);
+    if (TASK_MSGS * (TASK_MSGS + 1) / 2 != tasks[0].sum) {
+        printf("FAILED, sum %d\n", tasks[0].sum);
+        return;
+    }
+
+    for (i = 1; i < TASK_COUNT; i++)
+        sem_post(&task_sem);
+    for (i = 1; i < TASK_COUNT; i++) {
+        cx_task_join(&tasks[i].task);
+        if (3 != tasks[i].sum) {
+            printf("FAILED, task %d got to %d\n", i, tasks[i].sum);
+            return;
+        }
+    }
+
+    // Posts made while it is not waiting are lost, so keep posting
+    tasks[0].sum = 0;
+    cx_task_start(&tasks[0].task, listener, NULL);
+    for (i = 0; (i < 1000) && (TASK_EVENTS > tasks[0].sum); i++) {
+        cx_event_post(TASK_EVENT);
+        cx_msleep(1);
+    }
+    if (TASK_EVENTS != tasks[0].sum) {
+        printf("FAILED, %d events seen\n", tasks[0].sum);
+        return;
+    }
+    cx_task_join(&tasks[0].task);
+    printf("OK\n");
+}
+
+i32 summer(struct cx_task *task) {
+    struct test_task *tt = (struct test_task *) task;
+
+    CX_TASK_BEGIN(task);
+    tt->sum = 0;
+    while (1) {
+        CX_TASK_AWAIT_MSG(task, &task_mbox, &tt->msg);
+        if (0 > tt->msg.msg_tag)
+            break;
+        tt->sum += tt->msg.msg_tag;
+    }
+    CX_TASK_END(task);
+}
+
+i32 listener(struct cx_task *task) {
+    struct test_task *tt = (struct test_task *) task;
+
+    CX_TASK_BEGIN(task);
+    for (tt->sum = 0; tt->sum < TASK_EVENTS; tt->sum++)
+        CX_TASK_AWAIT_EVENT(task, TASK_EVENT);
+    CX_TASK_END(task);
+}
+
+i32 sleeper(struct cx_task *task) {
+    struct test_task *tt = (struct test_task *) task;
+
+    CX_TASK_BEGIN(task);
+    tt->sum = 0;
+    for (tt->i = 0; tt->i < 2; tt->i++) {
+        CX_TASK_SLEEP(task, 5);
+        CX_TASK_YIELD(task);
+        tt->sum++;
+    }
+    CX_TASK_AWAIT_SEM(task, &task_sem);
+    tt->sum++;
+    CX_TASK_END(task);
+}
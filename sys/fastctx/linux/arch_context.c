@@ -0,0 +1,224 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * @file arch_context.c
+ *      Thread contexts switched by hand instead of with swapcontext
+ */
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+/*
+ * Define GNU GCC attribute
+ */
+#  ifndef _UNUSED_
+#    define _UNUSED_ __attribute__ ((unused))
+#  endif
+
+    /*
+     * For UNIT8/u16..etc
+     */
+#include <stdarg.h>
+#include <arch_types.h>
+#include <arch_lib.h>
+
+    /*
+     * CX
+     *
+     * Same set as the ucontext backend; <chrysalix.h> conflicts
+     * with stdlib and stdio
+     */
+#include <cx_arch.h>
+#include <chrysalix/queue.h>
+#include <chrysalix/pqueue.h>
+#include <chrysalix/list.h>
+#include <chrysalix/cx_err.h>
+#include <chrysalix/cx.h>
+#include <chrysalix/cx_isr.h>
+#include <chrysalix/cx_utils.h>
+#include <chrysalix/cx_msg.h>
+#include <chrysalix/cx_io.h>
+#include <chrysalix/cx_drv.h>
+#include <chrysalix/cx_stdio.h>
+#include <chrysalix/cx_string.h>
+#include <chrysalix/cx_sync.h>
+#include <chrysalix/cx_event.h>
+#include <chrysalix/cx_console.h>
+#include <chrysalix/cx_mem.h>
+#include <chrysalix/cx_proc.h>
+
+#include "arch_context.h"
+#include "cx_sched.h"
+
+/****************************************************************
+ * Defines
+ */
+#if defined(__x86_64__)
+    /** mxcsr and x87 control word at their power-on defaults */
+#define FASTCTX_FPU_INIT    (0x1F80UL | (0x037FUL << 32))
+    /** fpu word, r15..r12, rbx, rbp, return address, and a null
+     *  return address for the entry function */
+#define FASTCTX_FRAME_WORDS 9
+#define FASTCTX_FRAME_RET   7
+#elif defined(__aarch64__)
+#define FASTCTX_FPU_INIT    0UL
+    /** x19..x30, d8..d15, fpcr and padding */
+#define FASTCTX_FRAME_WORDS 22
+#define FASTCTX_FRAME_RET   11
+#endif
+
+/****************************************************************
+ * Globals
+ */
+#define SCHEDSTKSZ  (30*1024)
+static u8 sched_stack[ARCH_NCPUS][SCHEDSTKSZ];
+static struct context blah[ARCH_NCPUS];
+
+/* ------------------------------------------------------------ */
+static void fastctx_entry_point(void) {
+    PCB_t *pcb;
+
+    cx_cpu_enter();
+    linux_entry_point_setup();
+
+    pcb = cx_get_current_pcb();
+    if (NULL == pcb) {
+        pcb = cx_get_sched_pcb();
+    }
+    pcb->th_cold->entry_info.fnc(pcb->th_cold->entry_info.arg);
+
+    /*
+     * There is nothing to return to.  Keep the kernel lock until
+     * we are off this stack and switch to the next thread.  A dead
+     * thread is never resumed.
+     */
+    (void) cx_intsoff();
+    cx_thread_end(cx_getpid());
+    arch_yield();
+}
+
+/* ------------------------------------------------------------ */
+static void sched_schedule_thread(_UNUSED_ i32 arg) {
+    /*
+     * The scheduler context only lets go of the kernel lock
+     * while it idles
+     */
+    (void) cx_intsoff();
+    while (1) {
+        cx_sched_schedule();
+    }
+}
+
+/**
+ * Initialize architecture context library
+ */
+void arch_context_init(void) {
+    u32 i;
+
+    for (i = 0; i < ARCH_NCPUS; i++)
+        blah[i].sp = NULL;
+}
+
+/*
+ * Initialize specified context.
+ *
+ * Lays out a frame at the top of the stack that looks as if the
+ * thread had called fastctx_switch() from the start of
+ * fastctx_entry_point(), so the first switch to it "returns" there.
+ * The entry function is reached by a return rather than a call, so
+ * the frame keeps the stack aligned the way a call would.
+ */
+void arch_context_set(PCB_t * pcb) {
+    unsigned long top;
+    unsigned long *frame;
+    int i;
+
+    top = (unsigned long) pcb->th_cold->stack_info.stack +
+        (unsigned long) pcb->th_cold->stack_info.stack_size;
+    top &= ~15UL;
+
+    frame = (unsigned long *) top - FASTCTX_FRAME_WORDS;
+    for (i = 0; i < FASTCTX_FRAME_WORDS; i++) {
+        frame[i] = 0;
+    }
+    frame[FASTCTX_FRAME_RET] = (unsigned long) fastctx_entry_point;
+#if defined(__x86_64__)
+    frame[0] = FASTCTX_FPU_INIT;
+#elif defined(__aarch64__)
+    frame[20] = FASTCTX_FPU_INIT;
+#endif
+
+    CX_SCHED_CTX(pcb)->sp = frame;
+}
+
+/*
+ * Switch to new context
+ */
+void arch_context_switch(struct context *prev, struct context *next) {
+    fastctx_switch(&prev->sp, next->sp);
+}
+
+void arch_context_switch_start(void) {
+    arch_context_switch(&blah[arch_cpu_id()],
+                        &(cx_get_sched_pcb())->th_cold->ctx);
+}
+
+void arch_context_create_sched(PCB_t * sched_pcb, u32 cpu) {
+    strncpy(sched_pcb->th_cold->th_name, "sched", ARCH_MAX_THREAD_NAME);
+    sched_pcb->th_state = TH_RUNNING;
+    sched_pcb->th_cold->stack_info.stack = sched_stack[cpu];
+    sched_pcb->th_cold->stack_info.stack_size = SCHEDSTKSZ;
+    sched_pcb->th_cold->entry_info.fnc = sched_schedule_thread;
+    sched_pcb->th_cold->entry_info.arg = 0;
+    arch_context_set(sched_pcb);
+}
+
+/*
+ * Exceptions are not supported on this port
+ */
+void arch_context_save(_UNUSED_ struct context *ctx, _UNUSED_ int exc) {
+}
+
+void arch_context_restore(_UNUSED_ struct context *ctx, _UNUSED_ void *regs) {
+
+}
+
+/*
+ * Stack pointer a switched out context was saved at.  Its whole
+ * frame is at and above it.
+ */
+void *arch_context_sp(struct context *ctx) {
+    return (ctx->sp);
+}
+
+void arch_context_print(struct context *ctx) {
+    printf("Saved sp = 0x%x\n", (unsigned long) ctx->sp);
+}
@@ -0,0 +1,67 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+ 
+#ifndef _CX_GROUP_H
+#define _CX_GROUP_H
+
+/*****************************************************************
+ * Structures
+ */
+
+/**
+ * Thread group.  The threads of a group may together run for
+ * g_quota cycles in every g_period msecs, and hold g_mem_limit bytes
+ * of the heap.  0 means no limit.
+ *
+ * g_used is the cycles run since g_start, the start of the current
+ * period.  Once it reaches the quota the group is throttled: its
+ * threads that are ready wait on g_waiting instead of the run
+ * queues until g_timer starts the next period.  Cycles run past the
+ * quota are taken off the next period.
+ */
+struct group
+{
+    char                    g_name[ARCH_MAX_THREAD_NAME + 1];
+    u32                     g_inuse;
+    u32                     g_nthreads;
+    u32                     g_period;
+    u64                     g_quota;
+    u64                     g_used;
+    u64                     g_start;
+    u64                     g_cycles;
+    u32                     g_throttled;
+    u32                     g_throttles;
+    u32                     g_mem_limit;
+    u32                     g_mem_used;
+    u32                     g_mem_denied;
+    struct queue            g_waiting;
+    struct timer            g_timer;
+};
+
+#endif /* _CX_GROUP_H */
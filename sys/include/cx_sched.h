@@ -30,6 +30,9 @@
 #ifndef _CX_SCHED_H
 #define _CX_SCHED_H
 
+#include "cx_timer.h"
+#include "cx_group.h"
+
 /*****************************************************************
  * Defines
  */
@@ -45,12 +48,27 @@
 #define TH_SUSPENDED    (1 << 2)
 #define TH_SEMWAIT      (1 << 3)
 #define TH_MSG_REPLY    (1 << 4)
+#define TH_JOINING      (1 << 5)
 
 #define TH_HALTED       (1 << 8)
 #define TH_SIG_CONTEXT  (1 << 9)
 /** @} */
 
 #define CX_SCHED_IS_PCB_DEAD(pcb)       (TH_DEAD == (pcb)->th_state)
+#define CX_SCHED_IS_PID_DEAD(pid)       (TH_DEAD == pid_state[(pid)])
+
+#define CX_SCHED_IS_FIBER(pcb)  (TH_FIBER == (TH_FIBER & (pcb)->th_attr))
+
+    /** Context a thread is switched to and from */
+#define CX_SCHED_CTX(pcb)               \
+    (CX_SCHED_IS_FIBER(pcb) ? &(pcb)->th_home->cpu_fiber_ctx : \
+     &(pcb)->th_cold->ctx)
+
+    /** Change th_state or th_prio, and their copies by pid */
+#define CX_SCHED_SET_STATE(pcb, state)  \
+    (pid_state[(pcb)->th_pid] = (u16) ((pcb)->th_state = (state)))
+#define CX_SCHED_SET_PRIO(pcb, prio)    \
+    (pid_prio[(pcb)->th_pid] = (u8) ((pcb)->th_prio = (prio)))
 
 /*****************************************************************
  * Structures
@@ -60,6 +78,34 @@
 #define     TH_EVENT_PEND           0x2
 #define     TH_ASYNC_EVENT_PEND     0x4
 #define     TH_ASYNC_EVENT_INTR     0x8
+#define     TH_END_PEND             0x10
+#define     TH_PREEMPTED            0x20
+#define     TH_STACK_FILLED         0x40
+#define     TH_STACK_WARNED         0x80
+#define     TH_PERIODIC             0x100
+#define     TH_QUEUED               0x200
+#define     TH_THROTTLED            0x400
+#define     TH_GROUP_WAIT           0x800
+#define     TH_FIBER                0x1000
+
+struct cpu;
+struct cx_task;
+
+    /** Buckets in a latency histogram */
+#define LAT_BUCKETS             32
+
+/**
+ * Log-scale histogram of the cycles threads waited from being woken
+ * up until they ran.  Bucket i counts waits of 2^i up to 2^(i+1)
+ * cycles; the last bucket also counts all longer ones, and the
+ * first those under 2 cycles.
+ */
+struct lat_hist
+{
+    u32                  lh_count[LAT_BUCKETS];
+    u32                  lh_samples;
+    u64                  lh_max;
+};
 
 typedef struct
 {
@@ -87,26 +133,174 @@ typedef struct
     struct msg   *sent_msg;
 } ThreadPort_t;
 
-typedef struct
+/**
+ * The parts of a thread the scheduler does not look at when it
+ * picks the next thread: its entry point, stack, name, timers,
+ * accounting, EDF budget, links, and for threads their context,
+ * port, latency histogram and thread-local values.  These are only
+ * touched to switch to the thread or away from it, or when the
+ * thread sleeps, wakes, ends or is looked up.  th_pcb leads back
+ * to the hot part.
+ *
+ * Fibers get only the part up to ctx, PCB_COLD_FIBER_SIZE bytes.
+ * The rest is never touched for a fiber: its context is kept in
+ * cpu_fiber_ctx while it is on the shared stack and in its image
+ * otherwise, and it has no port, alarm, histogram of its own or
+ * thread-local values.
+ *
+ * A fiber that has been copied off the shared stack of its cpu
+ * keeps the th_image_len bytes it was using, and its context, in
+ * th_image, which has room for th_image_size.
+ */
+struct pcb_cold
 {
+    struct pcb                  *th_pcb;
     ThreadFncEntry_t        entry_info;
     ThreadStack_t           stack_info;
     ThreadEventHandler_t    eventhandler_info;
-    ThreadPort_t            th_port;
-    struct context              ctx;
-    struct queue                 sem_link;
-    u32                  th_attr;
-    u32                  th_state;
     char                    th_name[ARCH_MAX_THREAD_NAME + 1];
-    u32                  avg_time;
+    struct queue                 th_joiners;
+    u64                  th_grp_cycles;
+    u64                  th_wake_stamp;
     u32                  num_times_run;
-    u64                  sleep_time;
-    u64                  alarm_time;
+    u32                  th_nvcsw;
+    u32                  th_nivcsw;
+    u32                  th_wakeups;
+    u32                  th_migrations;
     u32                  wait_val;
+    u64                  sleep_time;
+    u32                  th_period;
+    u32                  th_rel_deadline;
+    u64                  th_budget;
+    u64                  th_release;
+    u64                  th_deadline;
+    u64                  th_job_cycles;
+    u32                  th_util;
+    u32                  th_misses;
+    u32                  th_throttles;
     fd_t                    uistream;
+    i32                  th_exit;
+    i32                  th_join_status;
+    struct timer                 sleep_timer;
+    struct queue                 free_link;
+    struct queue                 grp_link;
+    struct queue                 name_link;
+    struct queue                 name_dups;
+    u8                      *th_image;
+    u32                  th_image_len;
+    u32                  th_image_size;
+
+    /* Threads only */
+    struct context              ctx;
+    ThreadPort_t            th_port;
+    u64                  alarm_time;
+    struct timer                 alarm_timer;
+    struct lat_hist          th_lat;
+    void                    *th_tls[ARCH_MAX_TLS_KEYS];
+};
+
+    /** Bytes of the cold part a fiber has */
+#define PCB_COLD_FIBER_SIZE     \
+    ((offsetof(struct pcb_cold, ctx) + __alignof__(struct pcb_cold) - 1) & \
+     ~(__alignof__(struct pcb_cold) - 1))
+
+/**
+ * Thread.  Only the fields the scheduler reads and writes to pick
+ * and switch threads are kept here, in two cache lines starting on
+ * a line; the rest is kept apart in th_cold.  The PCBs are kept in
+ * arrays, so a scan of all threads steps over only this part.
+ */
+typedef struct __attribute__ ((aligned(ARCH_CACHE_LINE))) pcb
+{
+    struct pqueue_node           run_node;
+    u32                  th_attr;
+    u32                  th_state;
+    u32                  th_prio;
+    u32                  th_weight;
+    u64                  th_vruntime;
+    u64                  th_cycles;
+    struct cpu              *th_cpu;
+    struct cpu              *th_home;
+    struct group            *th_group;
+    struct pcb_cold         *th_cold;
+    u32                  th_lock_depth;
+    u32                  th_preempt_pending;
+    i32                  th_pid;
+    i32                  th_errno;
+    struct queue                 sem_link;
 
 } PCB_t;
 
+/**
+ * Virtual cpu.  A cpu runs one thread at a time; when it has
+ * nothing to run it sits in its own scheduler context.
+ *
+ * Each cpu has its own run queues, one per priority level, with
+ * bit N of cpu_runq_bitmap set when cpu_runq[N] is not empty.  A
+ * thread goes back to the queue of the cpu it last ran on (its
+ * home) when it becomes ready.  A cpu that runs out of work takes
+ * threads from the busiest cpu's queues.
+ *
+ * The threads of a level are ordered by virtual runtime: the cpu
+ * time they have run for, in cycles, scaled down by their weight.
+ * cpu_run_stamp is the cpu time of this cpu at its last pick; the
+ * thread running is charged what the cpu has run since.  Time the
+ * host gave to something else is not charged to it.  The one that has
+ * had the least goes next, so threads of a level share the cpu in
+ * proportion to their weights.  cpu_min_vruntime[N] is the virtual
+ * runtime of the last thread taken from cpu_runq[N]; threads that
+ * join the level start near it.
+ *
+ * cpu_stamp is the cycle count at the last switch on this cpu.  The
+ * cycles since then belong to the context running.
+ *
+ * cpu_handoff is the thread the thread running asked to yield to.
+ * The next pick on this cpu takes it if it is still waiting to run.
+ *
+ * The fibers of a cpu all run on cpu_fiber_stack, and
+ * cpu_fiber_owner is the one whose stack is on it now.  Its context
+ * is in cpu_fiber_ctx.  A fiber switched to while another one owns
+ * the stack is copied in by the scheduler context; cpu_fiber_next
+ * is the fiber it is to copy in and run.
+ */
+struct cpu
+{
+    PCB_t                   *cpu_current;
+    PCB_t                   cpu_sched;
+    struct pcb_cold         cpu_sched_cold;
+    u32                  cpu_id;
+    i32                  cpu_errno;
+    struct pqueue           cpu_runq[CX_PRIO_LEVELS];
+    u64                  cpu_min_vruntime[CX_PRIO_LEVELS];
+    u32                  cpu_runq_bitmap;
+    struct pqueue           cpu_edf;
+    u32                  cpu_edf_util;
+    u32                  cpu_nready;
+    u32                  cpu_steals;
+    u32                  cpu_preempts;
+    u64                  cpu_stamp;
+    u64                  cpu_run_stamp;
+    u64                  cpu_idle_cycles;
+    PCB_t                   *cpu_handoff;
+    u32                  cpu_handoffs;
+    u8                      *cpu_fiber_stack;
+    PCB_t                   *cpu_fiber_owner;
+    struct context              cpu_fiber_ctx;
+    PCB_t                   *cpu_fiber_next;
+    u32                  cpu_fiber_swaps;
+};
+
+extern struct cpu cpus[ARCH_NCPUS];
+extern struct lat_hist sched_lat;
+extern u16 pid_state[];
+extern u8 pid_prio[];
+
+#if ARCH_NCPUS > 32
+#error "The idle cpu mask holds at most 32 cpus"
+#endif
+
+#define CX_CPU_SELF()       (cx_cpu_self())
+
 
 
 /*****************************************************************
@@ -114,28 +308,84 @@ typedef struct
  */
 void  cx_sched_init(void);
 void  cx_sched_schedule(void);
+PCB_t *cx_sched_dispatch(void);
 void  cx_sched_start(void);
 i32   cx_in_signal_context( void );
 i32   cx_thread_set_state( i32      pid, u32  new_state);
 i32   cx_thread_set_state_pcb( PCB_t      *pcb, u32 new_state);
+void  cx_sched_requeue( PCB_t      *pcb );
+void  cx_sched_switch( PCB_t      *prev, PCB_t  *next );
+int   cx_sched_edf_cmp(struct pqueue_node *a, struct pqueue_node *b);
+int   cx_sched_fair_cmp(struct pqueue_node *a, struct pqueue_node *b);
+u64   cx_sched_thread_cycles( PCB_t      *pcb );
+void  cx_cpu_init(void);
+void  cx_cpu_start(u32 id);
+struct cpu *cx_cpu_self(void);
+PCB_t *cx_cpu_thread(void);
+void  cx_cpu_set_thread(PCB_t *pcb);
+void  cx_cpu_tick(void);
+void  cx_cpu_enter(void);
+void  cx_cpu_idle(i32 timeout);
+void  cx_cpu_kick(struct cpu *cpu);
+struct cpu *cx_cpu_find_idle(void);
+void  cx_sched_group_release(struct group *grp);
+void  cx_sched_lat_reset(void);
+u32   cx_sched_lat_nsecs(u64 cycles);
+u64   cx_sched_lat_pct(struct lat_hist *lh, u32 permyriad);
+void  cx_group_init(void);
+struct group *cx_group_get(i32 gid);
+i32   cx_group_id(struct group *grp);
+void  cx_group_charge(PCB_t *pcb, u64 cycles);
+i32   cx_group_mem_charge(u32 bytes);
+void  cx_group_mem_refund(i32 gid, u32 bytes);
+void  cx_group_print(void);
+void  cx_tls_exit(PCB_t *pcb);
+void  cx_tls_clear(i32 key);
+void  cx_idle_init(void);
+i32   cx_idle_run(void);
+void  cx_fiber_init(void);
+u8   *cx_fiber_stack(struct cpu *cpu);
+void  cx_fiber_swap(struct cpu *cpu, PCB_t *next);
+void  cx_fiber_end(PCB_t *pcb);
+void  cx_task_init(void);
+void  cx_task_grant(struct cx_task *task);
+void  cx_task_event_post(u32 val);
 
 PCB_t *cx_get_current_pcb(void);
 PCB_t *cx_get_sched_pcb(void);
 PCB_t *cx_get_pcb(i32 pid);
+u32    cx_sched_npids(void);
 
 /*****************************************************************
  * Arch Dep functions
  */
 void arch_context_init(void);
 void arch_context_set(PCB_t * pcb);
-void arch_context_create_sched(PCB_t * sched_pcb);
+void arch_context_create_sched(PCB_t * sched_pcb, u32 cpu);
 void arch_context_switch(struct context * prev, struct context * next);
 void arch_context_switch_start(void);
 void arch_context_save(struct context * ctx, int excls);
 void arch_context_restore(struct context * ctx, void *regs);
 void arch_context_print(struct context *ctx);
+void *arch_context_sp(struct context *ctx);
 void arch_yield(void);
 u64 arch_get_mtime(void);
+u64 arch_get_cycles(void);
+u64 arch_get_cpu_cycles(void);
+u64 arch_get_cycle_rate(void);
 i32 arch_drivers_load( void );
+void arch_idle(i32 timeout);
+u32 arch_cpu_id(void);
+void arch_cpu_init(void);
+void arch_cpu_start(u32 cpu);
+void arch_cpu_kick(u32 cpu);
+void arch_kernel_lock(void);
+void arch_kernel_unlock(void);
+void *arch_mem_map(u32 size);
+void arch_mem_unmap(void *mem, u32 size);
+void *arch_stack_map(u32 size);
+void arch_stack_unmap(void *stack, u32 size);
+void arch_preempt_init(u32 msecs);
+void arch_preempt_set(u32 cpu, u32 msecs);
 
 #endif /* _CX_SCHED_H */
@@ -0,0 +1,62 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+ 
+#ifndef _CX_TIMER_H
+#define _CX_TIMER_H
+
+/*****************************************************************
+ * Structures
+ */
+
+/**
+ * Kernel timer.  Calls @p tm_func once the time returned by
+ * arch_get_mtime() reaches @p tm_expire.
+ */
+struct timer
+{
+    struct pqueue_node  tm_link;
+    u64                 tm_expire;
+    void                (*tm_func)(void *arg);
+    void               *tm_arg;
+    u32                 tm_active;
+};
+
+#define CX_TIMER_IS_ACTIVE(tm)      (0 != (tm)->tm_active)
+
+/*****************************************************************
+ * Prototypes
+ */
+void  cx_timer_init( void );
+void  cx_timer_setup( struct timer *tm, void (*func)(void *arg), void *arg );
+void  cx_timer_add( struct timer *tm, u64 expire );
+void  cx_timer_cancel( struct timer *tm );
+void  cx_timer_expire( u64 now );
+i32   cx_timer_next( u64 *expire );
+
+#endif /* _CX_TIMER_H */
@@ -0,0 +1,395 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * @file cx_cpu.c
+ *      Virtual cpus and the kernel lock
+ *
+ * With ARCH_NCPUS > 1 every cpu is a host thread running its own
+ * scheduler context.  Threads run in parallel, but kernel data is
+ * only touched while holding the kernel lock, which is what
+ * cx_intsoff()/cx_intson() take and release.  The lock is
+ * recursive, and the depth is kept in the PCB of the context
+ * running, so it moves with a thread that changes cpus.
+ *
+ * A thread may give up the cpu while holding the lock, for example
+ * from inside sem_wait().  The lock then stays with the cpu and is
+ * handed to the context switched to, which resumes at its own
+ * depth.  So the lock is held across every context switch, and no
+ * other cpu can pick up a thread before its context has been saved.
+ *
+ * Threads can also be preempted when their time slice runs out
+ * (see cx_cpu_tick()).  A thread inside cx_intsoff() is not
+ * preempted there and then; the switch is put off until it calls
+ * cx_intson() for the last time.  The kernel relies on this for
+ * its critical sections, semaphores and rings among them.
+ *
+ * With a single cpu there is no lock to take, and cx_intsoff()
+ * only counts.
+ */
+
+/************************************************************************************
+ * Includes
+ */
+#include <chrysalix.h>
+#include "arch_context.h"
+#include "cx_sched.h"
+
+/************************************************************************************
+ * Globals
+ */
+struct cpu cpus[ARCH_NCPUS];
+
+    /** The cpu this host thread runs */
+static ARCH_CPU_LOCAL struct cpu *cpu_self = &cpus[0];
+
+    /** Thread whose context is running on this cpu, NULL for the scheduler */
+static ARCH_CPU_LOCAL PCB_t *cpu_thread;
+
+    /** Time slice in msecs, 0 when threads are never preempted */
+static u32 cpu_quantum = ARCH_PREEMPT_MSECS;
+
+#if ARCH_NCPUS > 1
+    /** Bit N is set while cpu N is parked waiting for work */
+static u32 cpu_idle_mask;
+#endif
+
+/************************************************************************************
+ * Functions
+ */
+
+/**
+ *      Initialize the cpu structures.  Called by the scheduler
+ *      before it creates the scheduler contexts.
+ *
+ * @ingroup cxgrp_os_start
+ */
+void cx_cpu_init(void) {
+    u32 i;
+
+    u32 prio;
+
+    for (i = 0; i < ARCH_NCPUS; i++) {
+        cpus[i].cpu_id = i;
+        cpus[i].cpu_current = NULL;
+        cpus[i].cpu_sched.th_cold = &cpus[i].cpu_sched_cold;
+        cpus[i].cpu_sched_cold.th_pcb = &cpus[i].cpu_sched;
+        for (prio = 0; prio < CX_PRIO_LEVELS; prio++) {
+            pqueue_init(&cpus[i].cpu_runq[prio], cx_sched_fair_cmp);
+            cpus[i].cpu_min_vruntime[prio] = 0;
+        }
+        cpus[i].cpu_runq_bitmap = 0;
+        pqueue_init(&cpus[i].cpu_edf, cx_sched_edf_cmp);
+        cpus[i].cpu_edf_util = 0;
+        cpus[i].cpu_nready = 0;
+        cpus[i].cpu_steals = 0;
+        cpus[i].cpu_preempts = 0;
+        cpus[i].cpu_idle_cycles = 0;
+        cpus[i].cpu_handoff = NULL;
+        cpus[i].cpu_handoffs = 0;
+        cpus[i].cpu_fiber_stack = NULL;
+        cpus[i].cpu_fiber_owner = NULL;
+        cpus[i].cpu_fiber_next = NULL;
+        cpus[i].cpu_fiber_swaps = 0;
+    }
+
+#if ARCH_NCPUS > 1
+    cpu_idle_mask = 0;
+    arch_cpu_init();
+#endif
+}
+
+/**
+ *      Start running this cpu.  Called once on each host thread
+ *      after the kernel is initialized; switches to the cpu's
+ *      scheduler context and never returns.
+ *
+ * @ingroup cxgrp_os_start
+ *
+ * @param[in] id
+ *      Cpu number
+ */
+void cx_cpu_start(u32 id) {
+    cpu_self = &cpus[id];
+    cpu_self->cpu_stamp = arch_get_cycles();
+    arch_preempt_init(cpu_quantum);
+    arch_context_switch_start();
+}
+
+/**
+ *      Return the cpu the caller runs on.  A thread that can be
+ *      preempted may be on another cpu by the time it looks at
+ *      the result, so hold the kernel lock while using it.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+struct cpu *cx_cpu_self(void) {
+    return (cpu_self);
+}
+
+/**
+ *      Return the thread running, or NULL in the scheduler
+ *      context.  The answer is read in one go, so it is right
+ *      even if the thread is preempted and moved to another cpu
+ *      in the middle of asking.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+PCB_t *cx_cpu_thread(void) {
+    return (cpu_thread);
+}
+
+/**
+ *      Record the context about to run on this cpu.  Called with
+ *      the lock held, just before switching to it.
+ *
+ * @ingroup cxgrp_kernel_only
+ *
+ * @param[in] pcb
+ *      Thread switched to, NULL for the scheduler context
+ */
+void cx_cpu_set_thread(PCB_t * pcb) {
+    cpu_thread = pcb;
+}
+
+/* ------------------------------------------------------------ */
+static PCB_t *cx_cpu_running(void) {
+    PCB_t *pcb = cpu_thread;
+
+    /*
+     * The scheduler context and the start up code are never
+     * preempted, so they stay on this cpu
+     */
+    if (NULL == pcb)
+        pcb = &cpu_self->cpu_sched;
+    return (pcb);
+}
+
+/* ------------------------------------------------------------ */
+static void cx_cpu_preempt(PCB_t * pcb) {
+    (void) cx_intsoff();
+
+    /*
+     * A thread running its signal handler cannot be put back on
+     * a run queue.  It gets another time slice instead.
+     */
+    if (TH_RUNNING == pcb->th_state) {
+        cpu_self->cpu_preempts++;
+        pcb->th_attr |= TH_PREEMPTED;
+        arch_yield();
+        pcb->th_attr &= ~TH_PREEMPTED;
+    }
+    cx_intson(0);
+}
+
+/* ------------------------------------------------------------ */
+unsigned long cx_intsoff(void) {
+    PCB_t *pcb = cx_cpu_running();
+
+    if (0 == pcb->th_lock_depth++) {
+#if ARCH_NCPUS > 1
+        arch_kernel_lock();
+#endif
+    }
+    return (0);
+}
+
+/* ------------------------------------------------------------ */
+void cx_intson(_UNUSED_ unsigned long s) {
+    PCB_t *pcb = cx_cpu_running();
+
+    /*
+     * Let go of the lock before dropping the count.  Until then a
+     * tick only marks the preemption pending.
+     */
+#if ARCH_NCPUS > 1
+    if (1 == pcb->th_lock_depth)
+        arch_kernel_unlock();
+#endif
+    if (0 == --pcb->th_lock_depth && 0 != pcb->th_preempt_pending) {
+        pcb->th_preempt_pending = 0;
+        cx_cpu_preempt(pcb);
+    }
+}
+
+/**
+ *      Called first thing in a context that has never run.  The
+ *      lock was handed over by the thread that switched to it, but
+ *      a new context has nothing to resume, so it drops it.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+void cx_cpu_enter(void) {
+    PCB_t *pcb = cx_cpu_running();
+
+    if (0 != pcb->th_lock_depth) {
+        pcb->th_lock_depth = 0;
+#if ARCH_NCPUS > 1
+        arch_kernel_unlock();
+#endif
+    }
+}
+
+/**
+ *      The time slice of the thread running on this cpu is used
+ *      up.  Called by the arch layer from its timer interrupt,
+ *      which arrives on the stack of the thread interrupted.
+ *
+ *      The thread is switched out right away unless it holds the
+ *      kernel lock, in which case it is switched out when it lets
+ *      go of it.  The interrupt returns once the thread is
+ *      switched back in.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+void cx_cpu_tick(void) {
+    PCB_t *pcb = cpu_thread;
+
+    if (NULL == pcb)
+        return;
+    if (0 != pcb->th_lock_depth) {
+        pcb->th_preempt_pending = 1;
+        return;
+    }
+    cx_cpu_preempt(pcb);
+}
+
+/**
+ *      Set the time slice after which a running thread is
+ *      preempted.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] msecs
+ *      Time slice in msecs of cpu time, 0 to only switch threads
+ *      when they yield
+ */
+void cx_preempt_set(u32 msecs) {
+    u32 i;
+    unsigned long s;
+
+    s = cx_intsoff();
+    cpu_quantum = msecs;
+    for (i = 0; i < ARCH_NCPUS; i++)
+        arch_preempt_set(i, msecs);
+    cx_intson(s);
+}
+
+/**
+ *      Return the time slice in msecs, 0 when threads are only
+ *      switched when they yield.
+ *
+ * @ingroup cxgrp_thread
+ */
+u32 cx_preempt_get(void) {
+    return (cpu_quantum);
+}
+
+/**
+ *      Park the cpu until there may be something to run.  Called
+ *      from the scheduler context with the lock held; the lock is
+ *      released while the cpu waits.
+ *
+ * @ingroup cxgrp_kernel_only
+ *
+ * @param[in] timeout
+ *      Longest time to wait in msecs, -1 to wait until woken
+ */
+void cx_cpu_idle(i32 timeout) {
+    struct cpu *cpu = cpu_self;
+    u64 now;
+#if ARCH_NCPUS > 1
+    u32 depth;
+#endif
+
+    /*
+     * The time spent parked is not the scheduler's
+     */
+    now = arch_get_cycles();
+    cpu->cpu_sched.th_cycles += now - cpu->cpu_stamp;
+
+#if ARCH_NCPUS > 1
+    depth = cpu->cpu_sched.th_lock_depth;
+    cpu->cpu_sched.th_lock_depth = 0;
+    cpu_idle_mask |= (1u << cpu->cpu_id);
+    arch_kernel_unlock();
+
+    arch_idle(timeout);
+
+    arch_kernel_lock();
+    cpu_idle_mask &= ~(1u << cpu->cpu_id);
+    cpu->cpu_sched.th_lock_depth = depth;
+#else
+    arch_idle(timeout);
+#endif
+
+    cpu->cpu_stamp = arch_get_cycles();
+    cpu->cpu_idle_cycles += cpu->cpu_stamp - now;
+}
+
+/**
+ *      A thread has become ready to run on @p cpu.  Wake that cpu
+ *      up if it is parked.  If it is busy, wake up some other
+ *      parked cpu instead, which will take the thread from it.
+ *      Called with the lock held.
+ *
+ * @ingroup cxgrp_kernel_only
+ *
+ * @param[in] cpu
+ *      Cpu whose run queue the thread was placed on
+ */
+void cx_cpu_kick(_UNUSED_ struct cpu *cpu) {
+#if ARCH_NCPUS > 1
+    u32 id;
+
+    if (0 == cpu_idle_mask)
+        return;
+
+    if (0 != (cpu_idle_mask & (1u << cpu->cpu_id)))
+        id = cpu->cpu_id;
+    else
+        id = (u32) __builtin_ctz(cpu_idle_mask);
+    cpu_idle_mask &= ~(1u << id);
+    arch_cpu_kick(id);
+#endif
+}
+
+/**
+ *      Return a parked cpu that has not been kicked yet, or NULL
+ *      if every cpu is busy.  Called with the lock held.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+struct cpu *cx_cpu_find_idle(void) {
+#if ARCH_NCPUS > 1
+    if (0 != cpu_idle_mask)
+        return (&cpus[__builtin_ctz(cpu_idle_mask)]);
+#endif
+    return (NULL);
+}
@@ -48,7 +48,6 @@ static i32 do_fds(i32 argc _UNUSED_, char **argv _UNUSED_);
  */
 static struct driver_entry ddlist[DRIVER_MAX];
 static struct file_entry fdlist[FD_MAX];
-i32 errno;
 fd_t stdout;
 
 static const struct console_fnc g_console_fncs[] = {
@@ -231,6 +230,7 @@ fd_t cx_open(const char *path, i32 flags, i32 mode) {
     i32 dev;
     fd_t fd;
     i32 retval;
+    i32 s;
 
     /*
      * Check arguments
@@ -239,39 +239,43 @@ fd_t cx_open(const char *path, i32 flags, i32 mode) {
         return (-EINVAL);
 
     /*
-     * Look for an open file descriptor
+     * Find driver
      */
-    for (fd = 0; fd < FD_MAX; fd++) {
-        if (NULL == DRV(fd)) {
+    for (dev = 0; dev < DRIVER_MAX; dev++) {
+        if (0 == strncmp(path, ddlist[dev].d_name, DRVNAME_MAX)) {
             break;
         }
     }
 
     /*
-     * Check if we found a file descriptor
+     * Driver not found
      */
-    if (FD_MAX == fd)
-        return (-ENFILE);
+    if (DRIVER_MAX == dev)
+        return (-ENODEV);
 
     /*
-     * Find driver
+     * Look for an open file descriptor
      */
-    for (dev = 0; dev < DRIVER_MAX; dev++) {
-        if (0 == strncmp(path, ddlist[dev].d_name, DRVNAME_MAX)) {
+    s = cx_intsoff();
+    for (fd = 0; fd < FD_MAX; fd++) {
+        if (NULL == DRV(fd)) {
             break;
         }
     }
 
     /*
-     * Driver not found
+     * Check if we found a file descriptor
      */
-    if (DRIVER_MAX == dev)
-        return (-ENODEV);
+    if (FD_MAX == fd) {
+        cx_intson(s);
+        return (-ENFILE);
+    }
 
     /*
      * Save the driver in the descriptor
      */
     DRV(fd) = &ddlist[dev];
+    cx_intson(s);
 
     /*
      * Call driver open call
@@ -66,12 +66,13 @@ i32 cx_event_wait(u32 val, i32 timeout) {
      * Check if there is a pending event.  If there is
      * return
      */
-    if ((current_pcb->wait_val == val) &&
+    if ((current_pcb->th_cold->wait_val == val) &&
         (TH_EVENT_PEND == (TH_EVENT_PEND & current_pcb->th_attr))) {
         /*
          * Clear the flag now that we have the event
          */
         current_pcb->th_attr &= ~TH_EVENT_PEND;
+        current_pcb->th_cold->wait_val = 0;
         cx_intson(s);
         return (0);
     }
@@ -84,29 +85,40 @@ i32 cx_event_wait(u32 val, i32 timeout) {
     /*
      * Save the value
      */
-    current_pcb->wait_val = val;
+    current_pcb->th_cold->wait_val = val;
 
     /*
      * If we have a timeout, then set the state to CXEEPING,
      * else set the state just to SUSPENDED.
      */
     if (-1 < timeout) {
-        current_pcb->sleep_time = (u64) timeout + arch_get_mtime();
+        current_pcb->th_cold->sleep_time = (u64) timeout + arch_get_mtime();
         cx_thread_set_state_pcb(current_pcb, TH_SLEEPING);
     } else {
-        current_pcb->th_state |= TH_SUSPENDED;
+        CX_SCHED_SET_STATE(current_pcb,
+                           current_pcb->th_state | TH_SUSPENDED);
     }
 
     /*
      * Wait for the next event
      */
-    if (0 > cx_yield())
+    if (0 > cx_yield()) {
+        current_pcb->th_cold->wait_val = 0;
+        cx_intson(s);
         return (-1);
+    }
 
     /*
-     * We came back, check if we timed out.  Interrupts are still off.
+     * We came back, so we are no longer waiting.  Clear the value
+     * so that later posts of it do not wake us up from some other
+     * wait.  Interrupts are still off.
      */
-    current_pcb->th_state &= ~TH_SUSPENDED;
+    current_pcb->th_cold->wait_val = 0;
+
+    /*
+     * Check if we timed out.
+     */
+    CX_SCHED_SET_STATE(current_pcb, current_pcb->th_state & ~TH_SUSPENDED);
     if (TH_EVENT_PEND != (TH_EVENT_PEND & current_pcb->th_attr)) {
         cx_intson(s);
         /*
@@ -137,19 +149,29 @@ i32 cx_event_wait(u32 val, i32 timeout) {
 i32 cx_event_post(u32 val) {
     u32 pid;
     PCB_t *pcb;
+    i32 s;
 
     /*
      * Go through the list looking for the value.  Don't
      * care if they in a TH_SUSPENDED state or not.
      */
-    for (pid = 0; pid < ARCH_MAX_THREADS; pid++) {
+    s = cx_intsoff();
+    for (pid = 0; (u32) pid < cx_sched_npids(); pid++) {
+        if (CX_SCHED_IS_PID_DEAD(pid))
+            continue;
         pcb = cx_get_pcb(pid);
-        if (pcb->wait_val == val) {
+        if (pcb->th_cold->wait_val == val) {
             if (0 <= cx_thread_set_state_pcb(pcb, TH_RUNNING))
                 pcb->th_attr |= TH_EVENT_PEND;
         }
     }
 
+    /*
+     * Then the tasks waiting for it
+     */
+    cx_task_event_post(val);
+    cx_intson(s);
+
     return (0);
 }
 
@@ -168,7 +190,7 @@ i32 cx_event_register(void (*eventhandler)(i32 val)) {
      * Save handler value
      */
     current_pcb = cx_get_current_pcb();
-    current_pcb->eventhandler_info.eventhandler = eventhandler;
+    current_pcb->th_cold->eventhandler_info.eventhandler = eventhandler;
 
     /*
      * Normal return
@@ -178,6 +200,7 @@ i32 cx_event_register(void (*eventhandler)(i32 val)) {
 
 i32 cx_event_send(i32 pid, i32 val) {
     PCB_t *pcb;
+    i32 s;
 
     /*
      * Get PCB
@@ -192,11 +215,30 @@ i32 cx_event_send(i32 pid, i32 val) {
         /*
          * Only change the state if it was not dead.
          */
+        s = cx_intsoff();
         if (!CX_SCHED_IS_PCB_DEAD(pcb)) {
             pcb->th_attr |= TH_ASYNC_EVENT_PEND;
-            pcb->eventhandler_info.val = val;
+            pcb->th_cold->eventhandler_info.val = val;
+
+            /*
+             * Wake it up so that it services the event.  Halted
+             * threads stay halted.
+             */
+            if (0 == (TH_HALTED & pcb->th_state)) {
+                if (TH_RUNNING != pcb->th_state) {
+                    /*
+                     * We woke you up!  WAKE UP!
+                     */
+                    pcb->th_attr |= TH_ASYNC_EVENT_INTR;
+                }
+
+                CX_SCHED_SET_STATE(pcb, TH_RUNNING);
+                cx_sched_requeue(pcb);
+            }
+            cx_intson(s);
             return (0);
         }
+        cx_intson(s);
 
         /*
          * PCB is not allocated, so cannot send the event
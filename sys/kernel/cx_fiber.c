@@ -0,0 +1,364 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * @file cx_fiber.c
+ *      Fibers
+ *
+ * A fiber is a thread without a stack of its own.  The fibers of a
+ * cpu all run on one stack of ARCH_FIBER_STACK_SIZE bytes, and the
+ * one whose stack is on it owns it.  When another fiber is switched
+ * to, the scheduler context copies the part of the stack the owner
+ * is using out to the owner's image, then copies the new fiber's
+ * image back to the same place.  A fiber is copied out only when
+ * another fiber needs the stack; switching between a fiber and
+ * ordinary threads copies nothing.
+ *
+ * The stack holds pointers into itself, so a fiber has to come back
+ * to the same addresses: it never leaves the cpu it started on.
+ * The context of the owner is kept in cpu_fiber_ctx, and copied out
+ * to the front of its image along with its stack.
+ *
+ * Images come in sizes from FIBER_IMAGE_MIN up to the whole stack,
+ * powers of two and the sizes half way between them, so an image
+ * wastes at most a third of itself.  The last size also has room
+ * for the context.  They are cut from slabs mapped from the host
+ * and kept on a free list for their size when given back.
+ */
+
+/************************************************************************************
+ * Includes
+ */
+#include <chrysalix.h>
+#include "arch_context.h"
+#include "cx_sched.h"
+#include "cx_stack.h"
+
+/************************************************************************************
+ * Defines
+ */
+    /** Smallest image, and up to ARCH_FIBER_STACK_SIZE and a context */
+#define FIBER_IMAGE_MIN         256
+#define FIBER_CLASSES           18
+
+    /** Bytes mapped at a time for images of one size */
+#define FIBER_SLAB_SIZE         (64*1024)
+
+#if (FIBER_IMAGE_MIN << ((FIBER_CLASSES - 2) / 2)) != ARCH_FIBER_STACK_SIZE
+#error "FIBER_CLASSES must reach from FIBER_IMAGE_MIN to ARCH_FIBER_STACK_SIZE"
+#endif
+
+/************************************************************************************
+ * Structures
+ */
+
+/**
+ * Images of one size.  A free image holds the next free one in its
+ * first bytes.
+ */
+struct image_class
+{
+    void                   *ic_free;
+    u32                     ic_size;
+    u32                     ic_slabs;
+};
+
+/************************************************************************************
+ * Prototypes
+ */
+static u8 *cx_fiber_image_alloc(u32 len, u32 * size);
+static void cx_fiber_image_free(u8 * image, u32 size);
+static i32 do_fibers(i32 argc, char **argv);
+
+/************************************************************************************
+ * Globals
+ */
+static struct image_class image_classes[FIBER_CLASSES];
+
+static const struct console_fnc g_console_fncs[] = {
+    { "fibers", do_fibers }
+};
+
+static struct console_fnc_list g_console_fnclist;
+
+/************************************************************************************
+ * Functions
+ */
+
+/**
+ *      Set up the image sizes and register the console command
+ *
+ * @ingroup cxgrp_os_start
+ */
+void cx_fiber_init(void) {
+    u32 i;
+
+    for (i = 0; i < FIBER_CLASSES; i++) {
+        image_classes[i].ic_free = NULL;
+        image_classes[i].ic_size = (FIBER_IMAGE_MIN << (i / 2)) +
+            ((i & 1) ? (FIBER_IMAGE_MIN << (i / 2)) / 2 : 0);
+        image_classes[i].ic_slabs = 0;
+    }
+    image_classes[FIBER_CLASSES - 1].ic_size =
+        ARCH_FIBER_STACK_SIZE + sizeof(struct context);
+
+    CX_CONSOLE_CREATE(g_console_fncs, g_console_fnclist);
+}
+
+/**
+ *      Return the stack the fibers of @p cpu share, allocating it
+ *      for the first fiber.  Called with the kernel lock held.
+ *
+ * @ingroup cxgrp_kernel_only
+ *
+ * @retval NULL
+ *      The host is out of memory
+ * @return
+ *      Lowest address of the stack
+ */
+u8 *cx_fiber_stack(struct cpu *cpu) {
+    u32 size = ARCH_FIBER_STACK_SIZE;
+
+    if (NULL == cpu->cpu_fiber_stack)
+        cpu->cpu_fiber_stack = cx_stack_alloc(&size);
+    return (cpu->cpu_fiber_stack);
+}
+
+/**
+ *      Put the fiber @p next on the shared stack of @p cpu, copying
+ *      off the fiber that is there.  Called from the scheduler
+ *      context, which has a stack of its own, with the kernel lock
+ *      held, just before switching to @p next.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+void cx_fiber_swap(struct cpu *cpu, PCB_t * next) {
+    struct pcb_cold *cold;
+    u8 *top;
+    u8 *sp;
+    u32 len;
+
+    top = cpu->cpu_fiber_stack + ARCH_FIBER_STACK_SIZE;
+
+    /*
+     * Everything the owner uses is at or above the stack
+     * pointer it was switched out at
+     */
+    if (NULL != cpu->cpu_fiber_owner) {
+        cold = cpu->cpu_fiber_owner->th_cold;
+        sp = (u8 *) arch_context_sp(&cpu->cpu_fiber_ctx);
+        if ((sp < cpu->cpu_fiber_stack) || (sp > top))
+            sp = cpu->cpu_fiber_stack;
+        len = sizeof(struct context) + (u32) (top - sp);
+
+        /*
+         * Get a bigger image if it does not fit, and a smaller one
+         * if it has shrunk a lot
+         */
+        if ((len > cold->th_image_size) || (len < cold->th_image_size / 4)) {
+            cx_fiber_image_free(cold->th_image, cold->th_image_size);
+            cold->th_image = cx_fiber_image_alloc(len, &cold->th_image_size);
+            if (NULL == cold->th_image) {
+                cx_llprintf("\nFATAL: out of memory for fiber images\n\r");
+                cx_die();
+            }
+        }
+        memcpy(cold->th_image, &cpu->cpu_fiber_ctx, sizeof(struct context));
+        memcpy(cold->th_image + sizeof(struct context), sp,
+               len - sizeof(struct context));
+        cold->th_image_len = len;
+    }
+
+    /*
+     * A fiber that has never run starts with a new context
+     */
+    cold = next->th_cold;
+    if (NULL == cold->th_image) {
+        arch_context_set(next);
+    } else {
+        len = cold->th_image_len - sizeof(struct context);
+        memcpy(&cpu->cpu_fiber_ctx, cold->th_image, sizeof(struct context));
+        memcpy(top - len, cold->th_image + sizeof(struct context), len);
+    }
+
+    cpu->cpu_fiber_owner = next;
+    cpu->cpu_fiber_swaps++;
+}
+
+/**
+ *      Add up the memory the live fibers take
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[out] mem
+ *      Number of fibers and the bytes of their PCBs and images
+ *
+ * @retval 0
+ *      Success
+ */
+i32 cx_fiber_mem(struct cx_fiber_mem *mem) {
+    struct pcb_cold *cold;
+    PCB_t *pcb;
+    u32 pid;
+    i32 s;
+
+    memset(mem, 0x0, sizeof(struct cx_fiber_mem));
+
+    s = cx_intsoff();
+    for (pid = 0; pid < cx_sched_npids(); pid++) {
+        if (CX_SCHED_IS_PID_DEAD(pid))
+            continue;
+        pcb = cx_get_pcb((i32) pid);
+        if (!CX_SCHED_IS_FIBER(pcb))
+            continue;
+        cold = pcb->th_cold;
+        mem->fibers++;
+        mem->image_bytes += cold->th_image_size;
+        mem->image_used += cold->th_image_len;
+    }
+    cx_intson(s);
+    mem->pcb_bytes = mem->fibers * (u32) (sizeof(PCB_t) +
+                                          PCB_COLD_FIBER_SIZE);
+
+    return (0);
+}
+
+/**
+ *      Let go of the image of a fiber that has ended.  A fiber
+ *      ending itself is still on the shared stack, but no other
+ *      fiber of its cpu can be copied on before it has switched
+ *      away.  Called with the kernel lock held.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+void cx_fiber_end(PCB_t * pcb) {
+    struct pcb_cold *cold = pcb->th_cold;
+
+    if (pcb == pcb->th_home->cpu_fiber_owner)
+        pcb->th_home->cpu_fiber_owner = NULL;
+
+    cx_fiber_image_free(cold->th_image, cold->th_image_size);
+    cold->th_image = NULL;
+    cold->th_image_len = 0;
+    cold->th_image_size = 0;
+}
+
+/************************************************************************************
+ * Private Functions
+ */
+
+/*
+ * Get an image with room for len bytes.  Its size is set in *size.
+ */
+static u8 *cx_fiber_image_alloc(u32 len, u32 * size) {
+    struct image_class *ic;
+    u8 *slab;
+    u32 slab_size;
+    u32 i;
+
+    for (i = 0; i < FIBER_CLASSES - 1; i++) {
+        if (len <= image_classes[i].ic_size)
+            break;
+    }
+    ic = &image_classes[i];
+
+    /*
+     * Out of images this size, cut a new slab into them
+     */
+    if (NULL == ic->ic_free) {
+        slab_size = (FIBER_SLAB_SIZE > ic->ic_size) ?
+            FIBER_SLAB_SIZE : ic->ic_size;
+        slab = (u8 *) arch_mem_map(slab_size);
+        if (NULL == slab)
+            return (NULL);
+        for (i = 0; i + ic->ic_size <= slab_size; i += ic->ic_size) {
+            *(void **) (slab + i) = ic->ic_free;
+            ic->ic_free = slab + i;
+        }
+        ic->ic_slabs++;
+    }
+
+    slab = (u8 *) ic->ic_free;
+    ic->ic_free = *(void **) slab;
+    *size = ic->ic_size;
+
+    return (slab);
+}
+
+/*
+ * Give back an image from cx_fiber_image_alloc()
+ */
+static void cx_fiber_image_free(u8 * image, u32 size) {
+    struct image_class *ic;
+    u32 i;
+
+    if (NULL == image)
+        return;
+
+    for (i = 0; i < FIBER_CLASSES - 1; i++) {
+        if (size == image_classes[i].ic_size)
+            break;
+    }
+    ic = &image_classes[i];
+    *(void **) image = ic->ic_free;
+    ic->ic_free = image;
+}
+
+static i32 do_fibers(i32 argc _UNUSED_, char **argv _UNUSED_) {
+    struct cx_fiber_mem mem;
+    PCB_t *pcb;
+    u32 mapped = 0;
+    u32 i;
+
+    printf("CPU OWNER SWAPS\n");
+    for (i = 0; i < ARCH_NCPUS; i++) {
+        if (NULL == cpus[i].cpu_fiber_stack)
+            continue;
+        pcb = cpus[i].cpu_fiber_owner;
+        if (NULL == pcb)
+            printf("%u - %u\n", i, cpus[i].cpu_fiber_swaps);
+        else
+            printf("%u %d %u\n", i, pcb->th_pid, cpus[i].cpu_fiber_swaps);
+    }
+
+    cx_fiber_mem(&mem);
+    for (i = 0; i < FIBER_CLASSES; i++) {
+        mapped += image_classes[i].ic_slabs *
+            ((FIBER_SLAB_SIZE > image_classes[i].ic_size) ?
+             FIBER_SLAB_SIZE : image_classes[i].ic_size);
+    }
+
+    printf("%u fibers, %u bytes of PCBs, %u bytes of stack and context "
+           "in images of %u bytes, %u KB of images mapped\n", mem.fibers,
+           mem.pcb_bytes, mem.image_used, mem.image_bytes, mapped / 1024);
+    if (0 != mem.fibers)
+        printf("%u bytes per fiber\n",
+               (mem.pcb_bytes + mem.image_bytes) / mem.fibers);
+    return (0);
+}
@@ -0,0 +1,422 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * @file cx_group.c
+ *      Thread groups
+ *
+ * A group puts a limit on what its threads may use together: cpu
+ * time in each period and bytes of the heap.  Every thread belongs
+ * to one group.  New threads join the group of the thread starting
+ * them; those started before any group was made are in the root
+ * group, which has no limits and cannot be destroyed.
+ *
+ * Cpu time is charged to the group when a thread of it gives up
+ * the cpu, the same time its virtual runtime is charged.  A period
+ * starts when the group first runs after the last one ended.  Once
+ * the quota of a period is used up the group is throttled until
+ * the period ends, and what was run past the quota is taken off
+ * the next one.  Periodic threads are charged but never throttled;
+ * their time is already reserved.
+ *
+ * Heap memory is charged to the group of the thread calling
+ * cx_heap_malloc() and given back to the same group when it is
+ * freed, whichever thread frees it.
+ */
+
+/************************************************************************************
+ * Includes
+ */
+#include <chrysalix.h>
+#include "arch_context.h"
+#include "cx_sched.h"
+
+/************************************************************************************
+ * Prototypes
+ */
+static void cx_group_refill(void *arg);
+static i32 do_group(i32 argc, char **argv);
+
+/************************************************************************************
+ * Globals
+ */
+static struct group groups[ARCH_MAX_GROUPS];
+
+static const struct console_fnc g_console_fncs[] = {
+    { "group", do_group }
+};
+
+static struct console_fnc_list g_console_fnclist;
+
+/************************************************************************************
+ * Functions
+ */
+
+/**
+ *      Set up the root group and register the console command.
+ *      The heap may have been used already, so what the root group
+ *      holds is left as it is.
+ *
+ * @ingroup cxgrp_os_start
+ */
+void cx_group_init(void) {
+    u32 i;
+
+    for (i = 0; i < ARCH_MAX_GROUPS; i++) {
+        queue_init(&groups[i].g_waiting);
+        cx_timer_setup(&groups[i].g_timer, cx_group_refill, &groups[i]);
+    }
+    strncpy(groups[0].g_name, "root", ARCH_MAX_THREAD_NAME);
+    groups[0].g_inuse = 1;
+
+    CX_CONSOLE_CREATE(g_console_fncs, g_console_fnclist);
+}
+
+/**
+ *      Make a new thread group.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] name
+ *      Name of the group
+ * @param[in] period
+ *      Period in msecs, 0 for no cpu limit
+ * @param[in] quota
+ *      Cpu time in msecs the threads of the group may use in each
+ *      period, all cpus together
+ * @param[in] mem_limit
+ *      Bytes of the heap the threads of the group may hold, 0 for
+ *      no limit
+ *
+ * @retval -1
+ *      Failure, errno is set to EINVAL if @p name is NULL, or
+ *      @p quota is 0 or more than @p period for a nonzero period,
+ *      or ENOSPC if there are ARCH_MAX_GROUPS groups already
+ * @return
+ *      Id of the new group
+ *
+ * @note
+ *      On more than one cpu the quota may be more than the period.
+ *      It is limited to the period times the number of cpus.
+ */
+i32 cx_group_create(const char *name, u32 period, u32 quota, u32 mem_limit) {
+    struct group *grp;
+    i32 gid;
+    i32 s;
+
+    if ((NULL == name) ||
+        ((0 != period) &&
+         ((0 == quota) || ((u64) quota > (u64) period * ARCH_NCPUS)))) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    s = cx_intsoff();
+    for (gid = 1; gid < ARCH_MAX_GROUPS; gid++) {
+        if (!groups[gid].g_inuse)
+            break;
+    }
+    if (ARCH_MAX_GROUPS == gid) {
+        cx_intson(s);
+        errno = ENOSPC;
+        return (-1);
+    }
+
+    grp = &groups[gid];
+    memset(grp->g_name, 0x0, sizeof(grp->g_name));
+    strncpy(grp->g_name, name, ARCH_MAX_THREAD_NAME);
+    grp->g_inuse = 1;
+    grp->g_nthreads = 0;
+    grp->g_period = period;
+    grp->g_quota = (0 == period) ? 0 : (u64) quota * arch_get_cycle_rate();
+    grp->g_used = 0;
+    grp->g_start = 0;
+    grp->g_cycles = 0;
+    grp->g_throttled = 0;
+    grp->g_throttles = 0;
+    grp->g_mem_limit = mem_limit;
+    grp->g_mem_used = 0;
+    grp->g_mem_denied = 0;
+    cx_intson(s);
+
+    return (gid);
+}
+
+/**
+ *      Destroy a thread group.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] gid
+ *      Id of the group
+ *
+ * @retval 0
+ *      Success
+ * @retval -1
+ *      Failure, errno is set to EINVAL if there is no such group or
+ *      it is the root group, or EBUSY if it still has threads or
+ *      holds heap memory
+ */
+i32 cx_group_destroy(i32 gid) {
+    struct group *grp;
+    i32 s;
+
+    s = cx_intsoff();
+    grp = cx_group_get(gid);
+    if ((NULL == grp) || (0 == gid)) {
+        cx_intson(s);
+        errno = EINVAL;
+        return (-1);
+    }
+    if ((0 != grp->g_nthreads) || (0 != grp->g_mem_used)) {
+        cx_intson(s);
+        errno = EBUSY;
+        return (-1);
+    }
+
+    cx_timer_cancel(&grp->g_timer);
+    grp->g_inuse = 0;
+    cx_intson(s);
+
+    return (0);
+}
+
+/**
+ *      Return the group of the id given, NULL if there is none
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+struct group *cx_group_get(i32 gid) {
+    if ((0 > gid) || (ARCH_MAX_GROUPS <= gid) || (!groups[gid].g_inuse))
+        return (NULL);
+
+    return (&groups[gid]);
+}
+
+/**
+ *      Return the id of a group
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+i32 cx_group_id(struct group *grp) {
+    return ((i32) (grp - groups));
+}
+
+/**
+ *      Charge the group of a thread for the cycles it has run since
+ *      it was last charged, and throttle the group if that uses up
+ *      its quota.  Called with the kernel lock held.
+ *
+ * @ingroup cxgrp_kernel_only
+ *
+ * @param[in] pcb
+ *      The thread
+ * @param[in] cycles
+ *      Cycles the thread has run in all
+ */
+void cx_group_charge(PCB_t * pcb, u64 cycles) {
+    struct group *grp = pcb->th_group;
+    u64 now;
+
+    grp->g_cycles += cycles - pcb->th_cold->th_grp_cycles;
+    if (0 == grp->g_quota) {
+        pcb->th_cold->th_grp_cycles = cycles;
+        return;
+    }
+
+    /*
+     * Start a new period if the last one is over
+     */
+    now = arch_get_mtime();
+    if ((!grp->g_throttled) && (now >= grp->g_start + grp->g_period)) {
+        grp->g_start = now;
+        grp->g_used = 0;
+    }
+
+    grp->g_used += cycles - pcb->th_cold->th_grp_cycles;
+    pcb->th_cold->th_grp_cycles = cycles;
+    if ((!grp->g_throttled) && (grp->g_used >= grp->g_quota)) {
+        grp->g_throttled = 1;
+        grp->g_throttles++;
+        cx_timer_add(&grp->g_timer, grp->g_start + grp->g_period);
+    }
+}
+
+/**
+ *      Charge the group of the running thread for heap memory.
+ *      Called with the kernel lock held.
+ *
+ * @ingroup cxgrp_kernel_only
+ *
+ * @param[in] bytes
+ *      Bytes to be taken from the heap
+ *
+ * @retval -1
+ *      The group would be over its limit, errno is set to ENOMEM
+ * @return
+ *      Id of the group charged, to be handed to
+ *      cx_group_mem_refund() when the memory is freed
+ */
+i32 cx_group_mem_charge(u32 bytes) {
+    struct group *grp;
+    PCB_t *pcb;
+
+    pcb = cx_cpu_thread();
+    grp = ((NULL == pcb) || (NULL == pcb->th_group)) ?
+        &groups[0] : pcb->th_group;
+
+    if ((0 != grp->g_mem_limit) &&
+        (bytes > grp->g_mem_limit - grp->g_mem_used)) {
+        grp->g_mem_denied++;
+        errno = ENOMEM;
+        return (-1);
+    }
+
+    grp->g_mem_used += bytes;
+    return (cx_group_id(grp));
+}
+
+/**
+ *      Give heap memory back to the group it was charged to.
+ *      Called with the kernel lock held.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+void cx_group_mem_refund(i32 gid, u32 bytes) {
+    if ((0 > gid) || (ARCH_MAX_GROUPS <= gid))
+        return;
+
+    groups[gid].g_mem_used -= bytes;
+}
+
+/**
+ *      Print what each group has used
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+void cx_group_print(void) {
+    struct group *grp;
+    u64 rate;
+    i32 gid;
+
+    rate = arch_get_cycle_rate();
+    printf("GID NAME THREADS RUNMS QUOTA THROTTLES MEM DENIED\n");
+    for (gid = 0; gid < ARCH_MAX_GROUPS; gid++) {
+        grp = &groups[gid];
+        if (!grp->g_inuse)
+            continue;
+
+        printf("%d %s %u %u ", gid, grp->g_name, grp->g_nthreads,
+               (u32) (grp->g_cycles / rate));
+        if (0 == grp->g_quota)
+            printf("- ");
+        else
+            printf("%u/%u/%u%s ", (u32) (grp->g_used / rate),
+                   (u32) (grp->g_quota / rate), grp->g_period,
+                   grp->g_throttled ? "!" : "");
+        printf("%u %u/", grp->g_throttles, grp->g_mem_used);
+        if (0 == grp->g_mem_limit)
+            printf("- ");
+        else
+            printf("%u ", grp->g_mem_limit);
+        printf("%u\n", grp->g_mem_denied);
+    }
+}
+
+/************************************************************************************
+ * Private Functions
+ */
+
+/*
+ * The period of a throttled group is over.  What it ran past its
+ * quota is taken off the new period, and it stays throttled for
+ * another if that uses it up.
+ */
+static void cx_group_refill(void *arg) {
+    struct group *grp = (struct group *) arg;
+    u64 now;
+
+    now = arch_get_mtime();
+    grp->g_used = (grp->g_used > grp->g_quota) ?
+        grp->g_used - grp->g_quota : 0;
+    grp->g_start += grp->g_period;
+    if (grp->g_start + grp->g_period <= now)
+        grp->g_start = now;
+
+    if (grp->g_used >= grp->g_quota) {
+        cx_timer_add(&grp->g_timer, grp->g_start + grp->g_period);
+        return;
+    }
+
+    grp->g_throttled = 0;
+    cx_sched_group_release(grp);
+}
+
+static i32 do_group(i32 argc, char **argv) {
+    i32 gid;
+
+    if ((argc < 2) || (0 == strncmp(argv[1], "list", 5))) {
+        cx_group_print();
+        return (0);
+    }
+
+    if ((0 == strncmp(argv[1], "new", 4)) && (argc > 4)) {
+        gid = cx_group_create(argv[2], (u32) atoi(argv[3]),
+                              (u32) atoi(argv[4]),
+                              (argc > 5) ? (u32) atoi(argv[5]) : 0);
+        if (0 > gid) {
+            printf("Unable to create group %s\n", argv[2]);
+            return (-1);
+        }
+        printf("Group %d %s\n", gid, argv[2]);
+        return (0);
+    }
+
+    if ((0 == strncmp(argv[1], "add", 4)) && (argc > 3)) {
+        if (0 > cx_thread_setgroup(atoi(argv[3]), atoi(argv[2]))) {
+            printf("Unable to add pid %s to group %s\n", argv[3], argv[2]);
+            return (-1);
+        }
+        return (0);
+    }
+
+    if ((0 == strncmp(argv[1], "del", 4)) && (argc > 2)) {
+        if (0 > cx_group_destroy(atoi(argv[2]))) {
+            printf("Unable to destroy group %s\n", argv[2]);
+            return (-1);
+        }
+        return (0);
+    }
+
+    printf("%s [list]\n", argv[0]);
+    printf("%s new <name> <period ms> <quota ms> [mem bytes]\n", argv[0]);
+    printf("%s add <gid> <pid>\n", argv[0]);
+    printf("%s del <gid>\n", argv[0]);
+    return (-1);
+}
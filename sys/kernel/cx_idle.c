@@ -0,0 +1,268 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * @file cx_idle.c
+ *      Idle-time work
+ *
+ * Work that can wait for a cpu to have nothing else to do, such as
+ * tidying up or gathering statistics, is registered as an idle
+ * hook.  When no thread is able to run, a cpu calls the next hook
+ * that has work pending instead of parking, then looks for threads
+ * again.  Each call is one slice: the hook does a small, bounded
+ * piece of its work and returns nonzero if it has more.  A hook
+ * with nothing left is not called again until cx_idle_kick() says
+ * it has work, so a cpu with no work at all still parks.
+ *
+ * Hooks run in the scheduler context of the cpu with the kernel
+ * lock held.  They must not block: no sleeping, semaphores,
+ * messages or printing.
+ */
+
+/************************************************************************************
+ * Includes
+ */
+#include <chrysalix.h>
+#include "arch_context.h"
+#include "cx_sched.h"
+
+/************************************************************************************
+ * Structures
+ */
+struct idle_hook
+{
+    char                    h_name[ARCH_MAX_THREAD_NAME + 1];
+    i32                     (*h_fn)(void *arg);
+    void                   *h_arg;
+    u32                     h_inuse;
+    u32                     h_pending;
+    u32                     h_calls;
+    u64                     h_cycles;
+};
+
+/************************************************************************************
+ * Prototypes
+ */
+static i32 do_idle(i32 argc, char **argv);
+
+/************************************************************************************
+ * Globals
+ */
+static struct idle_hook idle_hooks[ARCH_MAX_IDLE_HOOKS];
+
+    /** Hook to look at first on the next call, for round-robin */
+static u32 idle_next;
+
+static const struct console_fnc g_console_fncs[] = {
+    { "idle", do_idle }
+};
+
+static struct console_fnc_list g_console_fnclist;
+
+/************************************************************************************
+ * Functions
+ */
+
+/**
+ *      Register the console command
+ *
+ * @ingroup cxgrp_os_start
+ */
+void cx_idle_init(void) {
+    CX_CONSOLE_CREATE(g_console_fncs, g_console_fnclist);
+}
+
+/**
+ *      Register work to be done when a cpu has nothing else to do.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] name
+ *      Name of the hook
+ * @param[in] fn
+ *      Called with @p arg to do one slice of the work.  Returns
+ *      nonzero if there is more to do.  It must not block.
+ * @param[in] arg
+ *      Argument passed to @p fn
+ *
+ * @retval -1
+ *      Failure, errno is set to EINVAL if @p name or @p fn is NULL,
+ *      or ENOSPC if ARCH_MAX_IDLE_HOOKS hooks are registered
+ * @return
+ *      Id of the hook.  It is called the next time a cpu is idle.
+ */
+i32 cx_idle_register(const char *name, i32 (*fn)(void *arg), void *arg) {
+    struct idle_hook *hook;
+    i32 id;
+    unsigned long s;
+
+    if ((NULL == name) || (NULL == fn)) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    s = cx_intsoff();
+    for (id = 0; id < ARCH_MAX_IDLE_HOOKS; id++) {
+        if (!idle_hooks[id].h_inuse)
+            break;
+    }
+    if (ARCH_MAX_IDLE_HOOKS == id) {
+        cx_intson(s);
+        errno = ENOSPC;
+        return (-1);
+    }
+
+    hook = &idle_hooks[id];
+    memset(hook, 0x0, sizeof(*hook));
+    strncpy(hook->h_name, name, ARCH_MAX_THREAD_NAME);
+    hook->h_fn = fn;
+    hook->h_arg = arg;
+    hook->h_inuse = 1;
+    hook->h_pending = 1;
+    cx_cpu_kick(CX_CPU_SELF());
+    cx_intson(s);
+
+    return (id);
+}
+
+/**
+ *      Remove an idle hook.  It is not called again.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] id
+ *      Id from cx_idle_register()
+ *
+ * @retval 0
+ *      Success
+ * @retval -1
+ *      Failure, errno is set to EINVAL if there is no such hook
+ */
+i32 cx_idle_unregister(i32 id) {
+    unsigned long s;
+
+    s = cx_intsoff();
+    if ((0 > id) || (ARCH_MAX_IDLE_HOOKS <= id) || (!idle_hooks[id].h_inuse)) {
+        cx_intson(s);
+        errno = EINVAL;
+        return (-1);
+    }
+
+    idle_hooks[id].h_inuse = 0;
+    cx_intson(s);
+
+    return (0);
+}
+
+/**
+ *      Tell an idle hook that has finished its work that there is
+ *      more.  A parked cpu is woken up to call it.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] id
+ *      Id from cx_idle_register()
+ *
+ * @retval 0
+ *      Success
+ * @retval -1
+ *      Failure, errno is set to EINVAL if there is no such hook
+ */
+i32 cx_idle_kick(i32 id) {
+    unsigned long s;
+
+    s = cx_intsoff();
+    if ((0 > id) || (ARCH_MAX_IDLE_HOOKS <= id) || (!idle_hooks[id].h_inuse)) {
+        cx_intson(s);
+        errno = EINVAL;
+        return (-1);
+    }
+
+    if (!idle_hooks[id].h_pending) {
+        idle_hooks[id].h_pending = 1;
+        cx_cpu_kick(CX_CPU_SELF());
+    }
+    cx_intson(s);
+
+    return (0);
+}
+
+/**
+ *      Call the next idle hook that has work pending.  Called from
+ *      the scheduler context with the lock held when no thread is
+ *      able to run.
+ *
+ * @ingroup cxgrp_kernel_only
+ *
+ * @retval 0
+ *      No hook has work, the cpu may park
+ * @retval 1
+ *      A hook was called.  Look for threads again before the next.
+ */
+i32 cx_idle_run(void) {
+    struct idle_hook *hook;
+    u64 start;
+    u32 i;
+
+    for (i = 0; i < ARCH_MAX_IDLE_HOOKS; i++) {
+        hook = &idle_hooks[(idle_next + i) % ARCH_MAX_IDLE_HOOKS];
+        if ((hook->h_inuse) && (hook->h_pending))
+            break;
+    }
+    if (ARCH_MAX_IDLE_HOOKS == i)
+        return (0);
+    idle_next = (idle_next + i + 1) % ARCH_MAX_IDLE_HOOKS;
+
+    start = arch_get_cycles();
+    hook->h_pending = (0 != hook->h_fn(hook->h_arg));
+    hook->h_cycles += arch_get_cycles() - start;
+    hook->h_calls++;
+
+    return (1);
+}
+
+/************************************************************************************
+ * Private Functions
+ */
+
+static i32 do_idle(i32 argc _UNUSED_, char **argv _UNUSED_) {
+    struct idle_hook *hook;
+    u32 i;
+
+    printf("ID NAME CALLS USECS PENDING\n");
+    for (i = 0; i < ARCH_MAX_IDLE_HOOKS; i++) {
+        hook = &idle_hooks[i];
+        if (!hook->h_inuse)
+            continue;
+        printf("%u %s %u %u %s\n", i, hook->h_name, hook->h_calls,
+               (u32) (hook->h_cycles * 1000 / arch_get_cycle_rate()),
+               hook->h_pending ? "yes" : "no");
+    }
+    return (0);
+}
@@ -32,6 +32,8 @@
  * Includes
  */
 #include <chrysalix.h>
+#include "arch_context.h"
+#include "cx_sched.h"
 
 /************************************************************************************
  * Defines
@@ -137,6 +139,11 @@ static u32 cx_heap_bytes_free(struct heap *heap) {
 }
 
 
+/*
+ * The block is charged to the group of the calling thread.  If that
+ * would put the group over its limit NULL is returned with errno set
+ * to ENOMEM, even for KM_CXEEP.
+ */
 void *cx_heap_malloc(u32 nbytes, enum cx_mem_attr attr,
                      enum heap_type heaptype) {
 
@@ -144,6 +151,8 @@ void *cx_heap_malloc(u32 nbytes, enum cx_mem_attr attr,
     struct mem *prev;
     struct heap *heap;
     u32 nunits;
+    i32 owner;
+    i32 s;
 
     /*
      * Check parameters
@@ -161,6 +170,13 @@ void *cx_heap_malloc(u32 nbytes, enum cx_mem_attr attr,
         return (NULL);
 
     nunits = (nbytes + sizeof(struct mem) - 1) / sizeof(struct mem) + 1;
+    s = cx_intsoff();
+    owner = cx_group_mem_charge(nunits * sizeof(struct mem));
+    if (0 > owner) {
+        cx_intson(s);
+        return (NULL);
+    }
+
     prev = heap->heap_start;
     p = prev->next;
     while (1) {
@@ -176,6 +192,8 @@ void *cx_heap_malloc(u32 nbytes, enum cx_mem_attr attr,
                 p->size = nunits;
 
             }
+            p->owner = (u32) owner;
+            cx_intson(s);
             return (void *) (p + 1);
 
         }
@@ -184,10 +202,13 @@ void *cx_heap_malloc(u32 nbytes, enum cx_mem_attr attr,
          * wrapped around - no block found
          */
         if (p == heap->heap_start) {
-            if (KM_CXEEP == attr)
+            if (KM_CXEEP == attr) {
                 sem_wait(&heap->sem_wait_for_mem);
-            else
+            } else {
+                cx_group_mem_refund(owner, nunits * sizeof(struct mem));
+                cx_intson(s);
                 return NULL;
+            }
         }
 
         prev = p;
@@ -204,6 +225,7 @@ void cx_heap_free(void *mem, enum heap_type heaptype) {
     struct heap *heap;
 
     i32 sem_value;
+    i32 s;
 
     /*
      * Check parameters
@@ -213,6 +235,10 @@ void cx_heap_free(void *mem, enum heap_type heaptype) {
 
     blk_hdr = (struct mem *) mem - 1;
 
+    s = cx_intsoff();
+    cx_group_mem_refund((i32) blk_hdr->owner,
+                        blk_hdr->size * sizeof(struct mem));
+
     heap = cx_get_heap(heaptype);
     prev = heap->heap_start;
     next = heap->heap_start->next;
@@ -254,6 +280,8 @@ void cx_heap_free(void *mem, enum heap_type heaptype) {
     if (sem_value < 0)
         sem_post(&heap->sem_wait_for_mem);
 
+    cx_intson(s);
+
 
 }
 
@@ -34,26 +34,127 @@
 #include "arch_context.h"
 #include "cx_sched.h"
 #include "cx_sched_console.h"
+#include "cx_stack.h"
 
 /************************************************************************************
  * Defines
  */
-#define THREAD_GETID()          ( (i32)((PCB_t *)current_pcb - (PCB_t *)pcblist) )
+#define PCB_GETID(pcb)          ((pcb)->th_pid)
+#define THREAD_GETID()          PCB_GETID(current_pcb)
+
+    /** Thread running on this cpu, NULL in the scheduler context */
+#define current_pcb             (cx_cpu_thread())
+
+    /** Is the queue link currently on a queue */
+#define CX_SCHED_IS_LINKED(q)   (NULL != queue_next(q))
+#define CX_SCHED_IS_QUEUED(pcb) (TH_QUEUED == (TH_QUEUED & (pcb)->th_attr))
+
+    /** Highest priority level with a thread ready to run on @p cpu */
+#define CX_SCHED_RUNQ_FIRST(cpu)    (__builtin_ctz((cpu)->cpu_runq_bitmap))
+
+#if CX_PRIO_LEVELS > 32
+#error "cpu_runq_bitmap holds at most 32 priority levels"
+#endif
+
+    /** PCBs are allocated this many at a time */
+#define PCB_SLAB_SHIFT          8
+#define PCB_SLAB_SIZE           (1 << PCB_SLAB_SHIFT)
+#define PCB_THREAD_SLABS        ((ARCH_MAX_THREADS + PCB_SLAB_SIZE - 1) / PCB_SLAB_SIZE)
+#define PCB_FIBER_SLABS         ((ARCH_MAX_FIBERS + PCB_SLAB_SIZE - 1) / PCB_SLAB_SIZE)
+#define PCB_SLABS               (PCB_THREAD_SLABS + PCB_FIBER_SLABS)
+
+    /**
+     * Most of a cpu, in thousandths, that periodic threads may
+     * reserve.  The rest is left for the other threads.
+     */
+#define EDF_UTIL_MAX            900
+
+    /**
+     * A thread that wakes up starts at most this many msecs of
+     * virtual runtime behind the others of its level, so a thread
+     * that slept a long time does not take over the cpu
+     */
+#define FAIR_WAKE_CREDIT        3
+
+    /** Buckets in the thread name index, a power of two */
+#define NAME_HASH_SIZE          1024
 
 /************************************************************************************
  * Prototypes
  */
-static i32 cx_thread_alloc(void);
+static i32 cx_thread_create(char *name, u8 * stack, u32 stacksize,
+                            void (*fnc)(i32 arg), i32 arg, u32 prio,
+                            u32 attr);
+static i32 cx_thread_alloc(u32 attr);
+static void cx_thread_free(PCB_t * pcb);
+static u32 cx_name_hash(const char *name);
+static PCB_t *cx_name_lookup(const char *name);
+static void cx_name_add(PCB_t * pcb);
+static void cx_name_remove(PCB_t * pcb);
 static void cx_set_current_pcb(PCB_t * pcb);
 static PCB_t *cx_sched_get_next_thread(void);
+static void cx_sched_sleep_expired(void *arg);
+static void cx_sched_alarm_expired(void *arg);
+static void cx_sched_unlink(struct queue *q);
+static void cx_sched_runq_add(PCB_t * pcb);
+static void cx_sched_runq_remove(PCB_t * pcb);
+static PCB_t *cx_sched_runq_take(struct cpu *cpu);
+static PCB_t *cx_sched_runq_steal(struct cpu *cpu);
+static PCB_t *cx_sched_runq_handoff(struct cpu *cpu);
+static struct cpu *cx_sched_pick_cpu(void);
+static void cx_sched_idle(void);
+static void cx_sched_edf_charge(PCB_t * pcb, u64 cycles);
+static void cx_sched_edf_next(PCB_t * pcb, u64 now);
+static void cx_sched_edf_leave(PCB_t * pcb);
+static void cx_sched_fair_charge(PCB_t * pcb, u64 cycles);
+static void cx_sched_fair_place(PCB_t * pcb);
+static void cx_sched_fair_move(PCB_t * pcb, struct cpu *cpu, u32 prio);
+static void cx_sched_lat_record(PCB_t * pcb, u64 cycles);
 static void dummy_handler(i32 val);
 
 /************************************************************************************
  * Globals
  */
-static PCB_t pcblist[ARCH_MAX_THREADS];
-static PCB_t *current_pcb;
-static PCB_t sched_pcb;
+
+    /**
+     * The PCBs by pid.  Slab N holds pids N * PCB_SLAB_SIZE and up;
+     * slabs are added as more threads are needed and never given
+     * back, so a PCB does not move while a pid refers to it.
+     */
+static PCB_t *pcb_slab[PCB_SLABS];
+static u32 pcb_nslabs;
+
+    /**
+     * How many of the slabs hold threads and how many fibers.  A
+     * slab holds only one or the other, so fibers do not use up
+     * the pids of threads.
+     */
+static u32 pcb_thread_slabs;
+static u32 pcb_fiber_slabs;
+
+    /** Dead PCBs of threads and of fibers, the longest dead first */
+static struct queue pcb_free;
+static struct queue pcb_fiber_free;
+
+    /**
+     * Live threads by name.  Only the first thread started with a
+     * name is on a bucket, through name_link; later threads with
+     * the same name are on a ring with it through name_dups.  The
+     * buckets hold each name once however many threads share it.
+     */
+static struct queue name_hash[NAME_HASH_SIZE];
+
+    /** Wakeup latency of all threads */
+struct lat_hist sched_lat;
+
+    /**
+     * The state and priority of the threads by pid, written along
+     * with th_state and th_prio.  A scan over all the threads reads
+     * these, 32 and 64 to a cache line, instead of a PCB each, and
+     * goes to the PCBs only of the threads it wants.
+     */
+u16 pid_state[PCB_SLABS * PCB_SLAB_SIZE];
+u8 pid_prio[PCB_SLABS * PCB_SLAB_SIZE];
 
 /************************************************************************************
  * Functions
@@ -129,30 +230,88 @@ i32 cx_getpid(void) {
  */
 i32 cx_thread_end(i32 pid) {
     PCB_t *pcb;
+    PCB_t *joiner;
+    i32 s;
 
     /*
      * Check argument is in range
      */
-    if ((0 > pid) || (pid >= ARCH_MAX_THREADS)) {
+    pcb = cx_get_pcb(pid);
+    if (NULL == pcb) {
         return (-ERANGE);
     }
 
+    s = cx_intsoff();
+    if (CX_SCHED_IS_PCB_DEAD(pcb)) {
+        cx_intson(s);
+        return (-ESRCH);
+    }
+
     /*
-     * Get PCB
+     * A thread ending itself keeps the status it set, and gets
+     * to clean up its thread-local values.  Fibers have none.
+     * A thread another cpu asked to be ended is current here
+     * when its own cpu finishes the job, but did not end itself.
      */
-    pcb = cx_get_pcb(pid);
+    if (current_pcb != pcb)
+        pcb->th_cold->th_exit = CX_EXIT_ENDED;
+    else if ((!CX_SCHED_IS_FIBER(pcb)) &&
+             (TH_END_PEND != (TH_END_PEND & pcb->th_attr)))
+        cx_tls_exit(pcb);
+
+    /*
+     * A thread running on another cpu is still using its stack.
+     * That cpu ends it when the thread gives up the cpu.
+     */
+    if ((NULL != pcb->th_cpu) && (CX_CPU_SELF() != pcb->th_cpu)) {
+        pcb->th_attr |= TH_END_PEND;
+        cx_intson(s);
+        return (0);
+    }
 
     /*
      * BAM!
      */
-    pcb->th_state = TH_DEAD;
+    if (TH_JOINING == (TH_JOINING & pcb->th_state))
+        cx_sched_unlink(&pcb->sem_link);
+    CX_SCHED_SET_STATE(pcb, TH_DEAD);
+    if (!CX_SCHED_IS_FIBER(pcb))
+        pcb->th_cold->alarm_time = 0;
+    cx_sched_requeue(pcb);
+    cx_sched_edf_leave(pcb);
+    cx_group_charge(pcb, cx_sched_thread_cycles(pcb));
+    pcb->th_group->g_nthreads--;
+    cx_name_remove(pcb);
+
+    /*
+     * Hand the exit status to the threads waiting for this one
+     */
+    while (!queue_empty(&pcb->th_cold->th_joiners)) {
+        joiner = queue_entry(queue_first(&pcb->th_cold->th_joiners), PCB_t,
+                             sem_link);
+        cx_sched_unlink(&joiner->sem_link);
+        joiner->th_cold->th_join_status = pcb->th_cold->th_exit;
+        cx_thread_set_state_pcb(joiner, TH_RUNNING);
+    }
 
     /*
      * Check the attributes to see if we need to free
      * the stack
      */
     if (TH_STACK_ALLOC == (TH_STACK_ALLOC & pcb->th_attr))
-        (void) cx_kfree(pcb->stack_info.stack);
+        cx_stack_free(pcb->th_cold->stack_info.stack,
+                      pcb->th_cold->stack_info.stack_size);
+    if (TH_FIBER == (TH_FIBER & pcb->th_attr))
+        cx_fiber_end(pcb);
+
+    /*
+     * The PCB can be handed out again once the lock is let go,
+     * by which time this thread is off its stack if it ended
+     * itself
+     */
+    cx_thread_free(pcb);
+
+    cx_intson(s);
 
     /*
      * Return
@@ -160,6 +319,96 @@ i32 cx_thread_end(i32 pid) {
     return (0);
 }
 
+/**
+ *      Wait for a thread to end and get its exit status.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] pid
+ *      Process id of the thread
+ * @param[out] status
+ *      Set to the exit status of the thread if not NULL: the value
+ *      it passed to cx_thread_exit(), 0 if it returned from its
+ *      entry function, or CX_EXIT_ENDED if another thread ended it
+ *
+ * @retval -1
+ *      Failure, errno is set to ESRCH if @p pid is out of range, or
+ *      EDEADLK if it is the calling thread
+ * @retval 0
+ *      The thread has ended
+ *
+ * @note
+ *      If the thread has already ended this returns at once with
+ *      the status it ended with.  Pids are reused, so that only
+ *      holds until another thread is started with the pid; wait
+ *      for a thread before too many others are started.
+ * @note
+ *      Any number of threads can wait for the same thread.
+ */
+i32 cx_thread_join(i32 pid, i32 * status) {
+    PCB_t *pcb;
+    PCB_t *self;
+    i32 exit;
+    i32 s;
+
+    pcb = cx_get_pcb(pid);
+    if (NULL == pcb) {
+        errno = ESRCH;
+        return (-1);
+    }
+
+    s = cx_intsoff();
+    self = current_pcb;
+    if (self == pcb) {
+        cx_intson(s);
+        errno = EDEADLK;
+        return (-1);
+    }
+
+    if (CX_SCHED_IS_PCB_DEAD(pcb)) {
+        exit = pcb->th_cold->th_exit;
+    } else {
+        /*
+         * Park on the wait queue of the thread until it ends.
+         * It takes us off the queue then, so being woken by a
+         * signal before that only means going back to sleep.
+         */
+        enqueue(&pcb->th_cold->th_joiners, &self->sem_link);
+        while (CX_SCHED_IS_LINKED(&self->sem_link)) {
+            cx_thread_set_state_pcb(self, TH_JOINING);
+            (void) cx_yield();
+        }
+        exit = self->th_cold->th_join_status;
+    }
+    cx_intson(s);
+
+    if (NULL != status)
+        *status = exit;
+    return (0);
+}
+
+/**
+ *      End the calling thread with an exit status for the threads
+ *      waiting for it in cx_thread_join().  Returning from the
+ *      entry function of a thread is the same as calling this
+ *      with 0.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] status
+ *      Exit status
+ */
+void cx_thread_exit(i32 status) {
+    /*
+     * Keep the kernel lock until we are off this stack.  A dead
+     * thread is never resumed.
+     */
+    (void) cx_intsoff();
+    current_pcb->th_cold->th_exit = status;
+    (void) cx_thread_end(cx_getpid());
+    arch_yield();
+}
+
 /**
  *      Return the process id with the specified process name.
  *
@@ -174,27 +423,23 @@ i32 cx_thread_end(i32 pid) {
  * @return
  *      Process ID matching the name provided
  *
+ * @note
+ *      Only the first ARCH_MAX_THREAD_NAME characters are
+ *      compared.  If several threads have the name, the one
+ *      started first is returned.  Names are kept in a hash
+ *      index, so this does not depend on the number of threads.
  */
 i32 cx_findproc(const char *name) {
-    i32 pid;
     PCB_t *pcb;
+    i32 pid;
+    i32 s;
 
-    /*
-     * Search for the name through the list of PCBs.
-     * Return as soon as we find the first one.
-     */
-    for (pid = 0; pid < ARCH_MAX_THREADS; pid++) {
-        pcb = cx_get_pcb(pid);
-        if (!CX_SCHED_IS_PCB_DEAD(pcb)) {
-            if (0 == strncmp(pcb->th_name, name, ARCH_MAX_THREAD_NAME))
-                return (pid);
-        }
-    }
+    s = cx_intsoff();
+    pcb = cx_name_lookup(name);
+    pid = (NULL == pcb) ? -ENOENT : PCB_GETID(pcb);
+    cx_intson(s);
 
-    /*
-     * Name not found
-     */
-    return (-ENOENT);
+    return (pid);
 }
 
 /**
@@ -231,16 +476,16 @@ i32 cx_findname(i32 pid, char *name, u32 size) {
     if (NULL == name) {
         return (-EINVAL);
     }
-    if ((0 > pid) || (pid >= ARCH_MAX_THREADS)) {
+    pcb = cx_get_pcb(pid);
+    if (NULL == pcb) {
         return (-ERANGE);
     }
 
     /*
      * Get the name of the thread
      */
-    pcb = cx_get_pcb(pid);
     if (!CX_SCHED_IS_PCB_DEAD(pcb)) {
-        strncpy(name, cx_get_pcb(pid)->th_name, size);
+        strncpy(name, cx_get_pcb(pid)->th_cold->th_name, size);
         return (0);
     } else {
         /*
@@ -265,6 +510,21 @@ PCB_t *cx_get_current_pcb(void) {
     return (current_pcb);
 }
 
+/**
+ *      Return the location of errno for the thread running.
+ *      Each thread has its own, so that a thread switch or
+ *      another cpu cannot change it under the thread's feet.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+i32 *cx_errno(void) {
+    PCB_t *pcb = current_pcb;
+
+    if (NULL == pcb)
+        return (&CX_CPU_SELF()->cpu_errno);
+    return (&pcb->th_errno);
+}
+
 /**
  *      Return the address of the PCB for the scheduler.
  *
@@ -275,7 +535,7 @@ PCB_t *cx_get_current_pcb(void) {
  *
  */
 PCB_t *cx_get_sched_pcb(void) {
-    return (&sched_pcb);
+    return (&CX_CPU_SELF()->cpu_sched);
 }
 
 /**
@@ -293,13 +553,23 @@ PCB_t *cx_get_sched_pcb(void) {
  *
  */
 PCB_t *cx_get_pcb(i32 pid) {
-    if ((0 <= pid) && (pid < ARCH_MAX_THREADS)) {
-        return (&pcblist[pid]);
+    if ((0 <= pid) && ((u32) pid < cx_sched_npids())) {
+        return (&pcb_slab[pid >> PCB_SLAB_SHIFT][pid & (PCB_SLAB_SIZE - 1)]);
     } else {
         return (NULL);
     }
 }
 
+/**
+ *      Return one more than the highest pid that has a PCB.  Loops
+ *      over all threads go from 0 up to this, skipping dead ones.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+u32 cx_sched_npids(void) {
+    return (pcb_nslabs * PCB_SLAB_SIZE);
+}
+
 /**
  *  Initializes the scheduler.  This function also initializes
  *  the architecture specific context function (which start
@@ -311,25 +581,39 @@ PCB_t *cx_get_pcb(i32 pid) {
  *
  */
 void cx_sched_init(void) {
+    u32 i;
+
     /*
-     * Initalize Arch Context
+     * Initialize the cpus and their run queues.  This also clears
+     * their current pointers to show that we are just starting up.
      */
-    arch_context_init();
+    cx_cpu_init();
+    cx_timer_init();
+    cx_group_init();
+    queue_init(&pcb_free);
+    queue_init(&pcb_fiber_free);
+    for (i = 0; i < NAME_HASH_SIZE; i++)
+        queue_init(&name_hash[i]);
 
     /*
-     * Initialize Sched thread
+     * Initalize Arch Context
      */
-    arch_context_create_sched(&sched_pcb);
+    arch_context_init();
 
     /*
-     * Clear current pointer to show that we are just starting up
+     * Initialize a Sched thread for each cpu
      */
-    cx_set_current_pcb(NULL);
+    for (i = 0; i < ARCH_NCPUS; i++)
+        arch_context_create_sched(&cpus[i].cpu_sched, i);
 
     /*
      * Register console
      */
     cx_sched_console_init();
+    cx_stack_init();
+    cx_idle_init();
+    cx_fiber_init();
+    cx_task_init();
 
 }
 
@@ -351,7 +635,10 @@ i32 cx_thread_set_state(i32 pid, u32 new_state) {
 }
 
 i32 cx_thread_set_state_pcb(PCB_t * pcb, u32 new_state) {
+    u32 woken;
+    i32 s;
 
+    s = cx_intsoff();
     if ((NULL != pcb) && (!CX_SCHED_IS_PCB_DEAD(pcb))) {
         switch (new_state) {
         case TH_RUNNING:
@@ -359,12 +646,24 @@ i32 cx_thread_set_state_pcb(PCB_t * pcb, u32 new_state) {
         case TH_SEMWAIT:
         case TH_SLEEPING:
         case TH_MSG_REPLY:
-            pcb->th_state = (pcb->th_state & 0xff00) | new_state;
+        case TH_JOINING:
+            woken = (TH_RUNNING == new_state) &&
+                (TH_RUNNING != (pcb->th_state & 0xff));
+            CX_SCHED_SET_STATE(pcb, (pcb->th_state & 0xff00) | new_state);
+            cx_sched_requeue(pcb);
+
+            /*
+             * Time how long it waits to run
+             */
+            if (woken && CX_SCHED_IS_QUEUED(pcb))
+                pcb->th_cold->th_wake_stamp = arch_get_cycles();
             break;
         }
 
+        cx_intson(s);
         return (0);
     }
+    cx_intson(s);
 
     errno = EINVAL;
     return (-1);
@@ -373,6 +672,7 @@ i32 cx_thread_set_state_pcb(PCB_t * pcb, u32 new_state) {
 
 i32 cx_thread_halt(i32 pid) {
     PCB_t *pcb;
+    i32 s;
 
     pcb = cx_get_pcb(pid);
 
@@ -381,158 +681,901 @@ i32 cx_thread_halt(i32 pid) {
         return (-1);
     }
 
-    pcb->th_state |= TH_HALTED;
+    s = cx_intsoff();
+    CX_SCHED_SET_STATE(pcb, pcb->th_state | TH_HALTED);
+    cx_sched_requeue(pcb);
+    cx_intson(s);
     return (0);
 }
 
-/* ------------------------------------------------------------ */
-i32
-cx_thread_start(char *name,
-                u8 * stack, u32 stacksize, void (*fnc)(i32 arg), i32 arg) {
-
+/**
+ *      Change the priority level of a thread.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] pid
+ *      Process id of the thread
+ * @param[in] prio
+ *      New priority level, from CX_PRIO_HIGHEST to CX_PRIO_LOWEST
+ *
+ * @retval 0
+ *      Success
+ * @retval -1
+ *      Failure, errno is set
+ */
+i32 cx_thread_setprio(i32 pid, u32 prio) {
     PCB_t *pcb;
-    i32 pid;
+    i32 s;
 
-    /*
-     * Check params
-     */
-    if ((NULL == name) || (NULL == fnc) || (0 == stacksize)) {
+    if (CX_PRIO_LOWEST < prio) {
         errno = EINVAL;
         return (-1);
     }
 
-    /*
-     * Allocate a PCB
-     */
-    pid = cx_thread_alloc();
-    if (0 > pid) {
-        errno = ENOSPC;
+    s = cx_intsoff();
+    pcb = cx_get_pcb(pid);
+    if ((NULL == pcb) || (CX_SCHED_IS_PCB_DEAD(pcb))) {
+        cx_intson(s);
+        errno = ESRCH;
         return (-1);
     }
 
     /*
-     * Clear thread attributes
+     * Move it to the queue of its new level
      */
-    pcb = cx_get_pcb(pid);
-    memset(pcb, 0x0, sizeof(PCB_t));
-    pcb->th_attr = TH_ATTR_NONE;
+    cx_sched_runq_remove(pcb);
+    cx_sched_fair_move(pcb, pcb->th_home, prio);
+    CX_SCHED_SET_PRIO(pcb, prio);
+    cx_sched_requeue(pcb);
+    cx_intson(s);
 
-    /*
-     * Allocate a stack if it has not been given
-     */
-    if (NULL == stack) {
-    /************* FIXME ********** USE cx_hal_getinfo() */
-        if (ARCH_MIN_STACK_SIZE > stacksize)
-            stacksize = ARCH_MIN_STACK_SIZE;
-        stack = (u8 *) cx_kmalloc(stacksize, KM_NOCXEEP);
-        if (NULL == stack) {
-            errno = ENOMEM;
-            return (-1);
-        }
+    return (0);
+}
 
-        /*
-         * Set the attribute so that we free the memory when
-         * the thread has finished
-         */
-        pcb->th_attr |= TH_STACK_ALLOC;
+/**
+ *      Return the priority level of a thread.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] pid
+ *      Process id of the thread
+ *
+ * @retval -1
+ *      Failure, errno is set
+ * @return
+ *      Priority level of the thread
+ */
+i32 cx_thread_getprio(i32 pid) {
+    PCB_t *pcb;
+
+    pcb = cx_get_pcb(pid);
+    if ((NULL == pcb) || (CX_SCHED_IS_PCB_DEAD(pcb))) {
+        errno = ESRCH;
+        return (-1);
     }
 
-    /*
-     * Initialize PCB information
-     */
-    strncpy(pcb->th_name, name, ARCH_MAX_THREAD_NAME);
-    pcb->th_state = TH_RUNNING;
-    pcb->stack_info.stack = stack;
-    pcb->stack_info.stack_size = stacksize;
-    pcb->entry_info.fnc = fnc;
-    pcb->entry_info.arg = arg;
-    pcb->num_times_run = 0;
-    pcb->eventhandler_info.eventhandler = dummy_handler;
+    return ((i32) pcb->th_prio);
+}
 
-    /*
-     * Initialize UI
-     */
-    if (0 > cx_getpid())
-        pcb->uistream = llstdout;
-    else
-        pcb->uistream = stdout;
+/**
+ *      Change the weight of a thread.  Threads of the same
+ *      priority level that are all able to run get the cpu in
+ *      proportion to their weights.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] pid
+ *      Process id of the thread
+ * @param[in] weight
+ *      New weight, from 1 to CX_WEIGHT_MAX.  Threads start with
+ *      CX_WEIGHT_DEFAULT.
+ *
+ * @retval 0
+ *      Success
+ * @retval -1
+ *      Failure, errno is set
+ */
+i32 cx_thread_setweight(i32 pid, u32 weight) {
+    struct cpu *cpu;
+    PCB_t *pcb;
+    u64 run;
+    i32 s;
 
-    /*
-     * Initialize port
-     */
-    sem_init(&pcb->th_port.sem_recv, 0);
-    sem_init(&pcb->th_port.sem_send, 1);
+    if ((0 == weight) || (CX_WEIGHT_MAX < weight)) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    s = cx_intsoff();
+    pcb = cx_get_pcb(pid);
+    if ((NULL == pcb) || (CX_SCHED_IS_PCB_DEAD(pcb))) {
+        cx_intson(s);
+        errno = ESRCH;
+        return (-1);
+    }
 
     /*
-     * Initialize architecture process context
+     * The time run so far is charged at the old weight.  A thread
+     * running on another cpu is charged when it gives that up.
      */
-    arch_context_set(pcb);
+    if (current_pcb == pcb) {
+        run = arch_get_cpu_cycles();
+        cpu = CX_CPU_SELF();
+        cx_sched_fair_charge(pcb, run - cpu->cpu_run_stamp);
+        cpu->cpu_run_stamp = run;
+    }
+    pcb->th_weight = weight;
+    cx_intson(s);
 
-    return (pid);
+    return (0);
 }
 
+/**
+ *      Return the weight of a thread.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] pid
+ *      Process id of the thread
+ *
+ * @retval -1
+ *      Failure, errno is set
+ * @return
+ *      Weight of the thread
+ */
+i32 cx_thread_getweight(i32 pid) {
+    PCB_t *pcb;
 
-/* ------------------------------------------------------------ */
-void cx_sched_schedule(void) {
-    PCB_t *next;
-
-    /*
-     * Get next PCB
-     *
-     * Keep checking the threads.  Maybe they are all sleeping
-     * and we need to wake them up.
-     */
-    do {
-        next = cx_sched_get_next_thread();
-    } while (NULL == next);
-
-    /*
-     * Change States
-     */
-    next->num_times_run++;
-    cx_set_current_pcb(next);
-    arch_context_switch(&sched_pcb.ctx, &next->ctx);
-}
+    pcb = cx_get_pcb(pid);
+    if ((NULL == pcb) || (CX_SCHED_IS_PCB_DEAD(pcb))) {
+        errno = ESRCH;
+        return (-1);
+    }
 
-/* ------------------------------------------------------------ */
-void cx_sched_start(void) {
-    arch_context_switch_start();
+    return ((i32) pcb->th_weight);
 }
 
-i32 cx_in_signal_context(void) {
-    return (TH_SIG_CONTEXT == current_pcb->th_state);
-}
+/**
+ *      Move a thread to another group.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] pid
+ *      Process id of the thread
+ * @param[in] gid
+ *      Id of the group, from cx_group_create(), or 0 for the root
+ *      group
+ *
+ * @retval 0
+ *      Success
+ * @retval -1
+ *      Failure, errno is set to ESRCH if there is no such thread,
+ *      or EINVAL if there is no such group
+ *
+ * @note
+ *      Heap memory the thread took stays charged to the group it
+ *      was taken in.  Threads the thread starts from now on are in
+ *      the new group.
+ */
+i32 cx_thread_setgroup(i32 pid, i32 gid) {
+    PCB_t *pcb;
+    struct group *grp;
+    i32 s;
 
-/* ------------------------------------------------------------ */
-static i32 cx_thread_signal_service(void) {
+    s = cx_intsoff();
+    pcb = cx_get_pcb(pid);
+    if ((NULL == pcb) || (CX_SCHED_IS_PCB_DEAD(pcb))) {
+        cx_intson(s);
+        errno = ESRCH;
+        return (-1);
+    }
+    grp = cx_group_get(gid);
+    if (NULL == grp) {
+        cx_intson(s);
+        errno = EINVAL;
+        return (-1);
+    }
 
     /*
-     * Clear the SIGNALED flag first in case we get
-     * signaled again
+     * The time run so far is charged to the old group
      */
-    current_pcb->th_attr &= ~TH_ASYNC_EVENT_PEND;
+    cx_sched_runq_remove(pcb);
+    cx_group_charge(pcb, cx_sched_thread_cycles(pcb));
+    pcb->th_group->g_nthreads--;
+    pcb->th_group = grp;
+    grp->g_nthreads++;
+    cx_sched_requeue(pcb);
+    cx_intson(s);
 
-    /*
-     * Check if the current thread has a registered signal handler
-     */
-    if (NULL != current_pcb->eventhandler_info.eventhandler) {
+    return (0);
+}
+
+/**
+ *      Return the id of the group of a thread.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] pid
+ *      Process id of the thread
+ *
+ * @retval -1
+ *      Failure, errno is set
+ * @return
+ *      Id of the group
+ */
+i32 cx_thread_getgroup(i32 pid) {
+    PCB_t *pcb;
+
+    pcb = cx_get_pcb(pid);
+    if ((NULL == pcb) || (CX_SCHED_IS_PCB_DEAD(pcb))) {
+        errno = ESRCH;
+        return (-1);
+    }
+
+    return (cx_group_id(pcb->th_group));
+}
+
+/**
+ *      Get how long a thread, or all threads, waited to run after
+ *      being woken up.  A thread is woken up when it is made able
+ *      to run again, by a semaphore, event, message, join or the
+ *      end of a sleep; the wait ends when it is switched to.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] pid
+ *      Process id of the thread, or -1 for all threads since the
+ *      counts were last reset
+ * @param[out] lat
+ *      Number of waits, percentiles and longest wait
+ *
+ * @retval 0
+ *      Success
+ * @retval -1
+ *      Failure, errno is set to ESRCH if there is no such thread,
+ *      or to EINVAL if it is a fiber, which only counts towards
+ *      all threads
+ */
+i32 cx_thread_latency(i32 pid, struct cx_lat *lat) {
+    struct lat_hist *lh;
+    PCB_t *pcb;
+    i32 s;
+
+    s = cx_intsoff();
+    if (-1 == pid) {
+        lh = &sched_lat;
+    } else {
+        pcb = cx_get_pcb(pid);
+        if ((NULL == pcb) || (CX_SCHED_IS_PCB_DEAD(pcb))) {
+            cx_intson(s);
+            errno = ESRCH;
+            return (-1);
+        }
+        if (CX_SCHED_IS_FIBER(pcb)) {
+            cx_intson(s);
+            errno = EINVAL;
+            return (-1);
+        }
+        lh = &pcb->th_cold->th_lat;
+    }
+
+    lat->samples = lh->lh_samples;
+    lat->p50 = cx_sched_lat_nsecs(cx_sched_lat_pct(lh, 5000));
+    lat->p99 = cx_sched_lat_nsecs(cx_sched_lat_pct(lh, 9900));
+    lat->p999 = cx_sched_lat_nsecs(cx_sched_lat_pct(lh, 9990));
+    lat->max = cx_sched_lat_nsecs(lh->lh_max);
+    cx_intson(s);
+
+    return (0);
+}
+
+/**
+ *      Clear the wakeup latency of all threads
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+void cx_sched_lat_reset(void) {
+    PCB_t *pcb;
+    u32 pid;
+    i32 s;
+
+    s = cx_intsoff();
+    memset(&sched_lat, 0x0, sizeof(sched_lat));
+    for (pid = 0; pid < cx_sched_npids(); pid++) {
+        if (CX_SCHED_IS_PID_DEAD(pid))
+            continue;
+        pcb = cx_get_pcb((i32) pid);
+        if (!CX_SCHED_IS_FIBER(pcb))
+            memset(&pcb->th_cold->th_lat, 0x0,
+                   sizeof(pcb->th_cold->th_lat));
+    }
+    cx_intson(s);
+}
+
+/**
+ *      Return the wait of a latency histogram that @p permyriad
+ *      ten-thousandths of the waits are no longer than, in cycles.
+ *      This is the top of the bucket it falls in, or the longest
+ *      wait if that is less.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+u64 cx_sched_lat_pct(struct lat_hist *lh, u32 permyriad) {
+    u64 rank;
+    u64 seen;
+    u64 top;
+    u32 i;
+
+    if (0 == lh->lh_samples)
+        return (0);
+
+    rank = ((u64) lh->lh_samples * permyriad + 9999) / 10000;
+    seen = 0;
+    for (i = 0; i < LAT_BUCKETS - 1; i++) {
+        seen += lh->lh_count[i];
+        if (seen >= rank)
+            break;
+    }
+
+    top = (2ULL << i) - 1;
+    return ((top < lh->lh_max) ? top : lh->lh_max);
+}
+
+/**
+ *      Convert cycles to nsecs, at most what fits in a u32
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+u32 cx_sched_lat_nsecs(u64 cycles) {
+    u64 nsecs;
+
+    if (cycles > (~0ULL / 1000000))
+        return (~0U);
+    nsecs = cycles * 1000000 / arch_get_cycle_rate();
+    return ((nsecs > ~0U) ? ~0U : (u32) nsecs);
+}
+
+/**
+ *      Make a thread periodic, or make a periodic thread an
+ *      ordinary one again.
+ *
+ *      A periodic thread runs a job every @p period msecs that
+ *      takes no more than @p budget msecs of cpu time and must be
+ *      done within @p deadline msecs of the start of the period.
+ *      It calls cx_thread_wait_period() when a job is done.
+ *      Periodic threads that are able to run come before all
+ *      others, the one with the earliest deadline first.  One that
+ *      uses up its budget waits for its next period, so the others
+ *      run in the time left over.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] pid
+ *      Process id of the thread
+ * @param[in] period
+ *      Period in msecs, 0 to make the thread an ordinary one
+ * @param[in] budget
+ *      Cpu time in msecs the thread may use in each period
+ * @param[in] deadline
+ *      Deadline in msecs from the start of each period, 0 for the
+ *      end of the period
+ *
+ * @retval 0
+ *      Success.  The first period starts now.
+ * @retval -1
+ *      Failure, errno is set to ESRCH if there is no such thread,
+ *      EINVAL if @p budget is 0 or more than @p deadline, or
+ *      @p deadline is more than @p period, or EBUSY if no cpu has
+ *      the time left for the thread
+ *
+ * @note
+ *      The time of each cpu that periodic threads can reserve is
+ *      limited to EDF_UTIL_MAX thousandths, and a thread is only
+ *      made periodic if its budget fits in what is left on some
+ *      cpu.  It stays on that cpu.
+ * @note
+ *      The budget is checked when the thread gives up the cpu, so
+ *      a thread that does not yield is only stopped as often as
+ *      threads are preempted.
+ */
+i32 cx_thread_set_periodic(i32 pid, u32 period, u32 budget, u32 deadline) {
+    PCB_t *pcb;
+    struct cpu *cpu;
+    u32 util;
+    u32 i;
+    i32 s;
+
+    if (0 == deadline)
+        deadline = period;
+    if ((0 != period) &&
+        ((0 == budget) || (budget > deadline) || (deadline > period))) {
+        errno = EINVAL;
+        return (-1);
+    }
+    util = (0 == period) ? 0 : (budget * 1000 + period - 1) / period;
+
+    s = cx_intsoff();
+    pcb = cx_get_pcb(pid);
+    if ((NULL == pcb) || (CX_SCHED_IS_PCB_DEAD(pcb))) {
+        cx_intson(s);
+        errno = ESRCH;
+        return (-1);
+    }
+
+    /*
+     * Give back what it had, then find the cpu with the most
+     * time left
+     */
+    cx_sched_runq_remove(pcb);
+    if (TH_THROTTLED == (TH_THROTTLED & pcb->th_attr))
+        CX_SCHED_SET_STATE(pcb, (pcb->th_state & 0xff00) | TH_RUNNING);
+    cx_sched_edf_leave(pcb);
+
+    if (0 != period) {
+        cpu = &cpus[0];
+        for (i = 1; i < ARCH_NCPUS; i++) {
+            if (cpus[i].cpu_edf_util < cpu->cpu_edf_util)
+                cpu = &cpus[i];
+        }
+        if (TH_FIBER == (TH_FIBER & pcb->th_attr))
+            cpu = pcb->th_home;
+        if (EDF_UTIL_MAX < cpu->cpu_edf_util + util) {
+            cx_sched_requeue(pcb);
+            cx_intson(s);
+            errno = EBUSY;
+            return (-1);
+        }
+
+        cpu->cpu_edf_util += util;
+        pcb->th_home = cpu;
+        pcb->th_cold->th_util = util;
+        pcb->th_cold->th_period = period;
+        pcb->th_cold->th_rel_deadline = deadline;
+        pcb->th_cold->th_budget = (u64) budget * arch_get_cycle_rate();
+        pcb->th_cold->th_release = arch_get_mtime();
+        pcb->th_cold->th_deadline = pcb->th_cold->th_release + deadline;
+        pcb->th_cold->th_job_cycles = cx_sched_thread_cycles(pcb);
+        pcb->th_attr |= TH_PERIODIC;
+    }
+
+    cx_sched_requeue(pcb);
+    cx_intson(s);
+
+    return (0);
+}
+
+/**
+ *      Called by a periodic thread when the job of the current
+ *      period is done.  Waits for the next period to start.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @retval 0
+ *      Success
+ * @retval -1
+ *      Failure, errno is set to EINVAL if the thread is not
+ *      periodic
+ *
+ * @note
+ *      A job done after its deadline is counted as a miss.  If
+ *      the next period has started already, it starts over from
+ *      now.
+ */
+i32 cx_thread_wait_period(void) {
+    u64 now;
+    i32 s;
+
+    s = cx_intsoff();
+    if (TH_PERIODIC != (TH_PERIODIC & current_pcb->th_attr)) {
+        cx_intson(s);
+        errno = EINVAL;
+        return (-1);
+    }
+
+    now = arch_get_mtime();
+    if (now > current_pcb->th_cold->th_deadline)
+        current_pcb->th_cold->th_misses++;
+    cx_sched_edf_next(current_pcb, now);
+    current_pcb->th_cold->th_job_cycles = cx_sched_thread_cycles(current_pcb);
+    current_pcb->th_cold->sleep_time = current_pcb->th_cold->th_release;
+    cx_thread_set_state_pcb(current_pcb, TH_SLEEPING);
+    (void) cx_yield();
+    cx_intson(s);
+
+    return (0);
+}
+
+/**
+ *      Order periodic threads by deadline for the run queues
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+int cx_sched_edf_cmp(struct pqueue_node *a, struct pqueue_node *b) {
+    PCB_t *pa = pqueue_entry(a, PCB_t, run_node);
+    PCB_t *pb = pqueue_entry(b, PCB_t, run_node);
+
+    if (pa->th_cold->th_deadline < pb->th_cold->th_deadline)
+        return (-1);
+    return (pa->th_cold->th_deadline > pb->th_cold->th_deadline);
+}
+
+/**
+ *      Order the threads of a priority level by virtual runtime
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+int cx_sched_fair_cmp(struct pqueue_node *a, struct pqueue_node *b) {
+    PCB_t *pa = pqueue_entry(a, PCB_t, run_node);
+    PCB_t *pb = pqueue_entry(b, PCB_t, run_node);
+
+    if (pa->th_vruntime < pb->th_vruntime)
+        return (-1);
+    return (pa->th_vruntime > pb->th_vruntime);
+}
+
+/**
+ *      Place the PCB on the scheduler queues that match its
+ *      current state and take it off the ones that do not.
+ *      Must be called every time @p th_state, @p sleep_time
+ *      or @p alarm_time are changed on a thread other than
+ *      the one running.
+ *
+ * @ingroup cxgrp_kernel_only
+ *
+ * @param[in] pcb
+ *      PCB of the thread
+ *
+ * @note
+ *      A running thread is never on the run queue.  It is
+ *      placed back on it when it gives up the cpu.
+ * @note
+ *      Must be called with the kernel lock held (cx_intsoff()).
+ */
+void cx_sched_requeue(PCB_t * pcb) {
+    struct pcb_cold *cold = pcb->th_cold;
+
+    /*
+     * Run queue
+     */
+    if ((TH_RUNNING == pcb->th_state) && (NULL == pcb->th_cpu)) {
+        if (!CX_SCHED_IS_QUEUED(pcb)) {
+            pcb->th_cold->th_wakeups++;
+            cx_sched_fair_place(pcb);
+            cx_sched_runq_add(pcb);
+            cx_cpu_kick(pcb->th_home);
+        }
+    } else {
+        cx_sched_runq_remove(pcb);
+    }
+
+    /*
+     * Sleep timer
+     */
+    if (TH_SLEEPING == (TH_SLEEPING & pcb->th_state)) {
+        if ((!CX_TIMER_IS_ACTIVE(&cold->sleep_timer)) ||
+            (cold->sleep_timer.tm_expire != cold->sleep_time))
+            cx_timer_add(&cold->sleep_timer, cold->sleep_time);
+    } else {
+        cx_timer_cancel(&cold->sleep_timer);
+    }
+
+    /*
+     * Alarm timer, which fibers do not have
+     */
+    if (CX_SCHED_IS_FIBER(pcb))
+        return;
+    if ((0 != cold->alarm_time) && (!CX_SCHED_IS_PCB_DEAD(pcb))) {
+        if ((!CX_TIMER_IS_ACTIVE(&cold->alarm_timer)) ||
+            (cold->alarm_timer.tm_expire != cold->alarm_time))
+            cx_timer_add(&cold->alarm_timer, cold->alarm_time);
+    } else {
+        cx_timer_cancel(&cold->alarm_timer);
+    }
+}
+
+/**
+ *      Put the threads that waited for a throttled group back on
+ *      the run queues now that the group may run again.
+ *
+ * @ingroup cxgrp_kernel_only
+ *
+ * @note
+ *      Must be called with the kernel lock held (cx_intsoff()).
+ */
+void cx_sched_group_release(struct group *grp) {
+    PCB_t *pcb;
+
+    while (!queue_empty(&grp->g_waiting)) {
+        pcb = queue_entry(queue_first(&grp->g_waiting), struct pcb_cold,
+                          grp_link)->th_pcb;
+        cx_sched_runq_remove(pcb);
+        cx_sched_fair_place(pcb);
+        cx_sched_runq_add(pcb);
+        cx_cpu_kick(pcb->th_home);
+    }
+}
+
+/* ------------------------------------------------------------ */
+i32
+cx_thread_start(char *name,
+                u8 * stack, u32 stacksize, void (*fnc)(i32 arg), i32 arg) {
+    return (cx_thread_start_prio(name, stack, stacksize, fnc, arg,
+                                 CX_PRIO_DEFAULT));
+}
+
+/**
+ *      Start a new thread at the priority level specified.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] name
+ *      Name of the thread
+ * @param[in] stack
+ *      Stack for the thread, or NULL to have one allocated
+ * @param[in] stacksize
+ *      Size of the stack in bytes
+ * @param[in] fnc
+ *      Function to run
+ * @param[in] arg
+ *      Argument passed to @p fnc
+ * @param[in] prio
+ *      Priority level, from CX_PRIO_HIGHEST (0) to CX_PRIO_LOWEST
+ *
+ * @retval -1
+ *      Failure, errno is set
+ * @return
+ *      Process id of the new thread
+ *
+ * @note
+ *      A thread runs only when no thread of a higher priority
+ *      level is able to run.  Threads at the same level share the
+ *      cpu by weight: the one with the least cpu time, scaled down
+ *      by its weight (see cx_thread_setweight()), runs next.
+ */
+i32
+cx_thread_start_prio(char *name,
+                     u8 * stack, u32 stacksize,
+                     void (*fnc)(i32 arg), i32 arg, u32 prio) {
+    return (cx_thread_create(name, stack, stacksize, fnc, arg, prio,
+                             TH_ATTR_NONE));
+}
+
+/**
+ *      Start a fiber: a thread that has no stack of its own.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] name
+ *      Name of the fiber
+ * @param[in] fnc
+ *      Function to run
+ * @param[in] arg
+ *      Argument passed to @p fnc
+ *
+ * @retval -1
+ *      Failure, errno is set
+ * @return
+ *      Process id of the new fiber
+ *
+ * @note
+ *      The fibers of a cpu take turns on one stack of
+ *      ARCH_FIBER_STACK_SIZE bytes.  When a fiber is switched to,
+ *      the bytes of stack it was using are copied onto it, and those
+ *      of the fiber that was there are copied out.  Switching
+ *      between a fiber and a thread copies nothing.  In exchange,
+ *      switching from one fiber to another costs a copy, and a fiber
+ *      never moves to another cpu.
+ * @note
+ *      A waiting fiber costs its 128 byte PCB, a 352 byte cold part
+ *      with no context, TLS, alarm, port or latency histogram, and
+ *      an image of its context and the stack it was using.  With
+ *      test_fibers that comes to about 1.3 KB a fiber with fastctx
+ *      and 2.4 KB with ucontext, whose context is near 1 KB.  Up to
+ *      ARCH_MAX_FIBERS fibers can run, apart from the threads.
+ * @note
+ *      Pointers to the stack of a fiber are only good while it runs,
+ *      so never hand one to another thread or fiber.  Apart from
+ *      that a fiber is a thread: it has a pid and a priority, can
+ *      block, be joined and be ended, but cx_tls_set(), cx_alarm(),
+ *      cx_msg_send() and cx_msg_recv() fail on it.
+ */
+i32 cx_fiber_start(char *name, void (*fnc)(i32 arg), i32 arg) {
+    return (cx_thread_create(name, NULL, ARCH_FIBER_STACK_SIZE, fnc, arg,
+                             CX_PRIO_DEFAULT, TH_FIBER));
+}
+
+
+/**
+ *      Choose the thread to run next and make it the current
+ *      thread.  The thread giving up the cpu is put back on the
+ *      run queue if it is still able to run, so the thread
+ *      returned may be the same one.
+ *
+ * @ingroup cxgrp_kernel_only
+ *
+ * @retval NULL
+ *      No thread is able to run.  The caller must switch to the
+ *      scheduler context, which idles until one can.
+ * @return
+ *      PCB of the thread to switch to
+ *
+ * @note
+ *      Called with the kernel lock held.  The caller keeps it
+ *      until the switch is done.
+ */
+PCB_t *cx_sched_dispatch(void) {
+    struct cpu *cpu = CX_CPU_SELF();
+    PCB_t *next;
+
+    next = cx_sched_get_next_thread();
+    if (NULL != cpu->cpu_current)
+        cpu->cpu_current->th_cpu = NULL;
+    if (NULL != next) {
+        if (0 != next->th_cold->th_wake_stamp) {
+            cx_sched_lat_record(next, arch_get_cycles() -
+                                next->th_cold->th_wake_stamp);
+            next->th_cold->th_wake_stamp = 0;
+        }
+        next->th_cold->num_times_run++;
+        next->th_cpu = cpu;
+        next->th_home = cpu;
+    }
+    cx_set_current_pcb(next);
+
+    return (next);
+}
+
+/**
+ *      Switch from the thread @p prev to @p next on this cpu.
+ *      The kernel lock is held across the switch: @p next
+ *      resumes with the lock depth it had when it was switched
+ *      out, and so does @p prev when it is switched back in,
+ *      possibly on another cpu.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+void cx_sched_switch(PCB_t * prev, PCB_t * next) {
+    struct cpu *cpu = CX_CPU_SELF();
+    u64 now;
+
+    /*
+     * Charge the cycles since the last switch to the context
+     * giving up the cpu
+     */
+    now = arch_get_cycles();
+    prev->th_cycles += now - cpu->cpu_stamp;
+    cpu->cpu_stamp = now;
+    if (prev != &cpu->cpu_sched) {
+        if (TH_PREEMPTED & prev->th_attr)
+            prev->th_cold->th_nivcsw++;
+        else
+            prev->th_cold->th_nvcsw++;
+    }
+    if (TH_STACK_FILLED ==
+        ((TH_STACK_FILLED | TH_STACK_WARNED) & prev->th_attr))
+        cx_stack_check(prev);
+
+    /*
+     * A fiber not on the shared stack has to be copied onto it.
+     * The context giving up the cpu may be running on that stack,
+     * so only the scheduler context can do it; go by way of it.
+     */
+    if ((TH_FIBER == (TH_FIBER & next->th_attr)) &&
+        (next != cpu->cpu_fiber_owner)) {
+        if (prev == &cpu->cpu_sched) {
+            cx_fiber_swap(cpu, next);
+        } else {
+            cpu->cpu_fiber_next = next;
+            next = &cpu->cpu_sched;
+        }
+    }
+
+    if (next == &cpu->cpu_sched)
+        cx_cpu_set_thread(NULL);
+    else
+        cx_cpu_set_thread(next);
+    arch_context_switch(CX_SCHED_CTX(prev), CX_SCHED_CTX(next));
+}
+
+/**
+ *      Return the cycles @p pcb has run for, counting the time
+ *      since it was last switched in if it is running now.  Called
+ *      with the kernel lock held.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+u64 cx_sched_thread_cycles(PCB_t * pcb) {
+    u64 cycles = pcb->th_cycles;
+
+    if (NULL != pcb->th_cpu)
+        cycles += arch_get_cycles() - pcb->th_cpu->cpu_stamp;
+    return (cycles);
+}
+
+/* ------------------------------------------------------------ */
+void cx_sched_schedule(void) {
+    struct cpu *cpu = CX_CPU_SELF();
+    PCB_t *next;
+
+    /*
+     * A thread switched here for a fiber it picked to be copied
+     * onto the shared stack.  The switch does the copy.
+     */
+    next = cpu->cpu_fiber_next;
+    if (NULL != next) {
+        cpu->cpu_fiber_next = NULL;
+        cx_sched_switch(cx_get_sched_pcb(), next);
+        return;
+    }
+
+    /*
+     * Get next PCB
+     *
+     * If no thread is able to run, they are all sleeping or
+     * waiting.  Park until one of them can.
+     */
+    next = cx_sched_dispatch();
+    while (NULL == next) {
+        cx_sched_idle();
+        next = cx_sched_dispatch();
+    }
+
+    /*
+     * Change States
+     */
+    cx_sched_switch(cx_get_sched_pcb(), next);
+}
+
+/* ------------------------------------------------------------ */
+void cx_sched_start(void) {
+#if ARCH_NCPUS > 1
+    u32 i;
+
+    /*
+     * The other cpus start in their scheduler contexts and
+     * wait for work like this one
+     */
+    for (i = 1; i < ARCH_NCPUS; i++)
+        arch_cpu_start(i);
+#endif
+
+    cx_cpu_start(0);
+}
+
+i32 cx_in_signal_context(void) {
+    return (TH_SIG_CONTEXT == current_pcb->th_state);
+}
+
+/* ------------------------------------------------------------ */
+static i32 cx_thread_signal_service(void) {
+
+    /*
+     * Clear the SIGNALED flag first in case we get
+     * signaled again
+     */
+    current_pcb->th_attr &= ~TH_ASYNC_EVENT_PEND;
+
+    /*
+     * Check if the current thread has a registered signal handler
+     */
+    if (NULL != current_pcb->th_cold->eventhandler_info.eventhandler) {
         /*
          * Set the state to show that we are in signal context
          *
          * XXXXXXXXXXXXXX FIX THIS - if we set this here we will not be scheduled again! XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
          */
-        current_pcb->th_state = TH_SIG_CONTEXT;
+        CX_SCHED_SET_STATE(current_pcb, TH_SIG_CONTEXT);
 
         /*
          * Call signal handler
          */
-        current_pcb->eventhandler_info.
-            eventhandler(current_pcb->eventhandler_info.val);
+        current_pcb->th_cold->eventhandler_info.
+            eventhandler(current_pcb->th_cold->eventhandler_info.val);
 
         /*
          * We are now out of signal context
          */
-        current_pcb->th_state = TH_RUNNING;
+        CX_SCHED_SET_STATE(current_pcb, TH_RUNNING);
     }
 
     /*
@@ -552,10 +1595,14 @@ static i32 cx_thread_signal_service(void) {
 
 /* ------------------------------------------------------------ */
 i32 cx_yield(void) {
+    i32 s;
+
     /*
      * Yield the cpu
      */
+    s = cx_intsoff();
     arch_yield();
+    cx_intson(s);
 
     /*
      * Check if we have been signaled and we are not in signal context.
@@ -571,11 +1618,49 @@ i32 cx_yield(void) {
     }
 }
 
+/**
+ *      Give the cpu straight to another thread.  If the thread is
+ *      waiting to run it runs next, ahead of the others of its
+ *      level, and the caller goes back on the run queue as it does
+ *      for cx_yield().  Otherwise this is the same as cx_yield().
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] pid
+ *      Process id of the thread to run next
+ *
+ * @retval 0
+ *      Success
+ * @retval -1
+ *      Failure, errno is set to EINTR if a signal came in
+ *
+ * @note
+ *      Meant for handing work to a thread known to be waiting for
+ *      it, such as the consumer of a buffer just filled.  The
+ *      thread is not run ahead of threads of a higher priority
+ *      level, or of periodic threads, that are waiting on this
+ *      cpu.  A thread waiting on another cpu is moved to this one.
+ */
+i32 cx_yield_to(i32 pid) {
+    PCB_t *pcb;
+    i32 s;
+
+    s = cx_intsoff();
+    pcb = cx_get_pcb(pid);
+    if ((NULL != pcb) && (pcb != current_pcb))
+        CX_CPU_SELF()->cpu_handoff = pcb;
+    cx_intson(s);
+
+    return (cx_yield());
+}
+
 /* ------------------------------------------------------------ */
 i32 cx_msleep(u32 msecs) {
     i32 retval;
+    i32 s;
 
-    current_pcb->sleep_time = (u64) msecs + arch_get_mtime();
+    s = cx_intsoff();
+    current_pcb->th_cold->sleep_time = (u64) msecs + arch_get_mtime();
     cx_thread_set_state_pcb(current_pcb, TH_SLEEPING);
 
     /*
@@ -584,11 +1669,12 @@ i32 cx_msleep(u32 msecs) {
      * will be filled in by yield()
      */
     (void) cx_yield();
+    cx_intson(s);
 
     /*
      * Calculate how much time we need to sleep
      */
-    retval = (i32) (current_pcb->sleep_time - arch_get_mtime());
+    retval = (i32) (current_pcb->th_cold->sleep_time - arch_get_mtime());
     if (0 >= retval) {
         return (0);
     } else {
@@ -604,7 +1690,7 @@ i32 cx_usleep(u32 usecs _UNUSED_) {
 /* ------------------------------------------------------------ */
 i32 cx_set_uistream(fd_t fd) {
     if ((0 <= fd) && (fd < ARCH_MAX_DESCRIPTORS)) {
-        cx_get_current_pcb()->uistream = fd;
+        cx_get_current_pcb()->th_cold->uistream = fd;
         return (0);
     } else {
         errno = EINVAL;
@@ -615,104 +1701,698 @@ i32 cx_set_uistream(fd_t fd) {
 
 /* ------------------------------------------------------------ */
 fd_t cx_get_uistream(void) {
-    return (cx_get_current_pcb()->uistream);
+    return (cx_get_current_pcb()->th_cold->uistream);
 }
 
 /************************************************************************************
  * Private Functions
  */
 
+/*
+ * Start a thread, or a fiber if @p attr has TH_FIBER
+ */
+static i32
+cx_thread_create(char *name, u8 * stack, u32 stacksize,
+                 void (*fnc)(i32 arg), i32 arg, u32 prio, u32 attr) {
+
+    PCB_t *pcb;
+    struct pcb_cold *cold;
+    i32 pid;
+    i32 s;
+
+    /*
+     * Check params
+     */
+    if ((NULL == name) || (NULL == fnc) || (0 == stacksize) ||
+        (CX_PRIO_LOWEST < prio)) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    s = cx_intsoff();
+
+    /*
+     * Allocate a PCB
+     */
+    pid = cx_thread_alloc(attr);
+    if (0 > pid) {
+        cx_intson(s);
+        errno = ENOSPC;
+        return (-1);
+    }
+
+    /*
+     * Clear thread attributes
+     */
+    pcb = cx_get_pcb(pid);
+    cold = pcb->th_cold;
+    memset(pcb, 0x0, sizeof(PCB_t));
+    memset(cold, 0x0, (TH_FIBER == (TH_FIBER & attr)) ?
+           PCB_COLD_FIBER_SIZE : sizeof(struct pcb_cold));
+    pcb->th_cold = cold;
+    cold->th_pcb = pcb;
+    pcb->th_pid = pid;
+    pcb->th_attr = attr;
+    pcb->th_home = cx_sched_pick_cpu();
+
+    /*
+     * A fiber runs on the stack its cpu shares among its fibers.
+     * Otherwise allocate a stack if it has not been given.  The
+     * size is rounded up to one the stack allocator has.
+     */
+    if (TH_FIBER == (TH_FIBER & attr)) {
+        stack = cx_fiber_stack(pcb->th_home);
+        if (NULL == stack) {
+            cx_thread_free(pcb);
+            cx_intson(s);
+            errno = ENOMEM;
+            return (-1);
+        }
+    } else if (NULL == stack) {
+        stack = cx_stack_alloc(&stacksize);
+        if (NULL == stack) {
+            cx_thread_free(pcb);
+            cx_intson(s);
+            errno = ENOMEM;
+            return (-1);
+        }
+
+        /*
+         * Set the attribute so that we free the memory when
+         * the thread has finished
+         */
+        pcb->th_attr |= TH_STACK_ALLOC;
+    }
+
+    /*
+     * Initialize PCB information
+     */
+    strncpy(pcb->th_cold->th_name, name, ARCH_MAX_THREAD_NAME);
+    cx_name_add(pcb);
+    CX_SCHED_SET_STATE(pcb, TH_RUNNING);
+    CX_SCHED_SET_PRIO(pcb, prio);
+    pcb->th_cold->stack_info.stack = stack;
+    pcb->th_cold->stack_info.stack_size = stacksize;
+    pcb->th_cold->entry_info.fnc = fnc;
+    pcb->th_cold->entry_info.arg = arg;
+    pcb->th_cold->num_times_run = 0;
+    pcb->th_weight = CX_WEIGHT_DEFAULT;
+    pcb->th_vruntime = pcb->th_home->cpu_min_vruntime[prio];
+    if ((NULL != current_pcb) && (NULL != current_pcb->th_group))
+        pcb->th_group = current_pcb->th_group;
+    else
+        pcb->th_group = cx_group_get(0);
+    pcb->th_group->g_nthreads++;
+    /* The first switch to it hands it the kernel lock */
+    pcb->th_lock_depth = 1;
+    pcb->th_cold->eventhandler_info.eventhandler = dummy_handler;
+    queue_init(&pcb->th_cold->th_joiners);
+    cx_timer_setup(&pcb->th_cold->sleep_timer, cx_sched_sleep_expired, pcb);
+
+    /*
+     * Initialize UI
+     */
+    if (0 > cx_getpid())
+        pcb->th_cold->uistream = llstdout;
+    else
+        pcb->th_cold->uistream = stdout;
+
+    /*
+     * Initialize the alarm and port, which fibers do not have
+     */
+    if (TH_FIBER != (TH_FIBER & attr)) {
+        cx_timer_setup(&pcb->th_cold->alarm_timer, cx_sched_alarm_expired,
+                       pcb);
+        sem_init(&pcb->th_cold->th_port.sem_recv, 0);
+        sem_init(&pcb->th_cold->th_port.sem_send, 1);
+    }
+
+    /*
+     * Initialize architecture process context.  The stack is
+     * filled first, as the context is set up at its top.  Another
+     * fiber may be on the stack of a fiber now, so its context is
+     * set up when it is first copied in.
+     */
+    if (TH_FIBER != (TH_FIBER & attr)) {
+        cx_stack_fill(pcb);
+        arch_context_set(pcb);
+    }
+
+    /*
+     * Ready to go
+     */
+    cx_sched_requeue(pcb);
+    cx_intson(s);
+
+    return (pid);
+}
+
 /* ------------------------------------------------------------ */
-static i32 cx_thread_alloc(void) {
-    i32 i;
+static i32 cx_thread_alloc(u32 attr) {
+    struct queue *head;
+    PCB_t *slab;
+    u8 *cold;
+    u32 cold_size;
+    u32 *nslabs;
+    u32 max;
+    u32 i;
+
+    if (TH_FIBER == (TH_FIBER & attr)) {
+        head = &pcb_fiber_free;
+        nslabs = &pcb_fiber_slabs;
+        max = PCB_FIBER_SLABS;
+        cold_size = PCB_COLD_FIBER_SIZE;
+    } else {
+        head = &pcb_free;
+        nslabs = &pcb_thread_slabs;
+        max = PCB_THREAD_SLABS;
+        cold_size = sizeof(struct pcb_cold);
+    }
 
-    for (i = 0; i < ARCH_MAX_THREADS; i++) {
-        if (CX_SCHED_IS_PCB_DEAD(&pcblist[i])) {
-            return (i);
+    /*
+     * Out of dead PCBs, add a slab of them, and a slab of the
+     * parts the scheduler does not look at, only as much of each
+     * as a fiber uses for fibers.  The memory comes cleared, so
+     * they all start out TH_DEAD.  The host backs the cold parts
+     * as threads first use them.
+     */
+    if (queue_empty(head)) {
+        if (max == *nslabs) {
+            errno = ENOMEM;
+            return (-1);
+        }
+        slab = (PCB_t *) arch_mem_map(PCB_SLAB_SIZE * sizeof(PCB_t));
+        if (NULL == slab) {
+            errno = ENOMEM;
+            return (-1);
+        }
+        cold = (u8 *) arch_mem_map(PCB_SLAB_SIZE * cold_size);
+        if (NULL == cold) {
+            arch_mem_unmap(slab, PCB_SLAB_SIZE * sizeof(PCB_t));
+            errno = ENOMEM;
+            return (-1);
+        }
+        for (i = 0; i < PCB_SLAB_SIZE; i++) {
+            slab[i].th_cold = (struct pcb_cold *) (cold + i * cold_size);
+            slab[i].th_pid = (i32) (pcb_nslabs * PCB_SLAB_SIZE + i);
+            slab[i].th_cold->th_pcb = &slab[i];
+            enqueue(head, &slab[i].th_cold->free_link);
         }
+        pcb_slab[pcb_nslabs++] = slab;
+        (*nslabs)++;
     }
 
+    return (queue_entry(dequeue(head), struct pcb_cold,
+                        free_link)->th_pcb->th_pid);
+}
+
+/* ------------------------------------------------------------ */
+static void cx_thread_free(PCB_t * pcb) {
+    if (CX_SCHED_IS_FIBER(pcb))
+        enqueue(&pcb_fiber_free, &pcb->th_cold->free_link);
+    else
+        enqueue(&pcb_free, &pcb->th_cold->free_link);
+}
+
+/* ------------------------------------------------------------ */
+static u32 cx_name_hash(const char *name) {
+    u32 hash = 2166136261U;
+    u32 i;
+
     /*
-     * If we are here, then we were unable to find a free PCB
+     * FNV-1a over the part of the name that is kept
      */
-    errno = ENOMEM;
-    return (-1);
+    for (i = 0; (i < ARCH_MAX_THREAD_NAME) && ('\0' != name[i]); i++) {
+        hash ^= (u8) name[i];
+        hash *= 16777619U;
+    }
+    return (hash & (NAME_HASH_SIZE - 1));
 }
 
 /* ------------------------------------------------------------ */
-static void cx_set_current_pcb(PCB_t * pcb) {
-    current_pcb = pcb;
+static PCB_t *cx_name_lookup(const char *name) {
+    struct queue *head;
+    struct queue *q;
+    PCB_t *pcb;
+
+    head = &name_hash[cx_name_hash(name)];
+    for (q = queue_first(head); !queue_end(head, q); q = queue_next(q)) {
+        pcb = queue_entry(q, struct pcb_cold, name_link)->th_pcb;
+        if (0 == strncmp(pcb->th_cold->th_name, name, ARCH_MAX_THREAD_NAME))
+            return (pcb);
+    }
+    return (NULL);
 }
 
 /* ------------------------------------------------------------ */
-/* XXXXXXXXXX MAYBE ADD THIS TO cx_sched_schedule XXXXXXXXXXXXXXXXXXXXXXXXXXXXX*/
-static PCB_t *cx_sched_get_next_thread(void) {
-    i32 pid;
-    i32 i;
+static void cx_name_add(PCB_t * pcb) {
+    PCB_t *first;
+
+    queue_init(&pcb->th_cold->name_dups);
+    first = cx_name_lookup(pcb->th_cold->th_name);
+    if (NULL == first)
+        enqueue(&name_hash[cx_name_hash(pcb->th_cold->th_name)],
+                &pcb->th_cold->name_link);
+    else
+        enqueue(&first->th_cold->name_dups, &pcb->th_cold->name_dups);
+}
 
-    pid = cx_getpid();
-    i = pid;
+/* ------------------------------------------------------------ */
+static void cx_name_remove(PCB_t * pcb) {
+    PCB_t *next;
 
     /*
-     * Search for the next available thread
-     *
-     * Note: TH_DEAD is mutual exclusive state
-     *
+     * The next oldest thread with the name takes its place on
+     * the bucket
      */
-    do {
-        if (++i >= ARCH_MAX_THREADS) {
-            i = 0;
+    if (CX_SCHED_IS_LINKED(&pcb->th_cold->name_link)) {
+        if (!queue_empty(&pcb->th_cold->name_dups)) {
+            next = queue_entry(queue_next(&pcb->th_cold->name_dups),
+                               struct pcb_cold, name_dups)->th_pcb;
+            queue_insert(&pcb->th_cold->name_link, &next->th_cold->name_link);
         }
+        cx_sched_unlink(&pcb->th_cold->name_link);
+    }
+    queue_remove(&pcb->th_cold->name_dups);
+}
 
-        if (TH_DEAD == pcblist[i].th_state)
-            continue;
+/* ------------------------------------------------------------ */
+static void cx_set_current_pcb(PCB_t * pcb) {
+    CX_CPU_SELF()->cpu_current = pcb;
+}
 
-        if (0 != (pcblist[i].th_state & TH_HALTED))
-            continue;
+/* ------------------------------------------------------------ */
+static void cx_sched_unlink(struct queue *q) {
+    if (CX_SCHED_IS_LINKED(q)) {
+        queue_remove(q);
+        q->next = q->prev = NULL;
+    }
+}
 
-        /*
-         * Check if the alarm has gone off
-         */
-        if ((0 != pcblist[i].alarm_time)
-            && (pcblist[i].alarm_time <= arch_get_mtime())) {
-            pcblist[i].alarm_time = 0;
-            cx_kill(i /* pid */ , SIGALRM);
-        }
+/* ------------------------------------------------------------ */
+static void cx_sched_runq_add(PCB_t * pcb) {
+    struct cpu *cpu = pcb->th_home;
 
+    if (TH_PERIODIC == (TH_PERIODIC & pcb->th_attr)) {
+        pqueue_insert(&cpu->cpu_edf, &pcb->run_node);
+    } else if (pcb->th_group->g_throttled) {
         /*
-         * Check for asynchronous events
+         * Its group has used up its quota.  It waits off the run
+         * queues until the group's next period.
          */
-        if (TH_ASYNC_EVENT_PEND ==
-            (TH_ASYNC_EVENT_PEND & pcblist[i].th_attr)) {
-            if (TH_RUNNING != pcblist[i].th_state) {
-                /*
-                 * We woke you up!  WAKE UP!
-                 */
-                pcblist[i].th_attr |= TH_ASYNC_EVENT_INTR;
-            }
-
-            pcblist[i].th_state = TH_RUNNING;
-        }
+        enqueue(&pcb->th_group->g_waiting, &pcb->th_cold->grp_link);
+        pcb->th_attr |= (TH_QUEUED | TH_GROUP_WAIT);
+        return;
+    } else {
+        pqueue_insert(&cpu->cpu_runq[pcb->th_prio], &pcb->run_node);
+        cpu->cpu_runq_bitmap |= (1u << pcb->th_prio);
+    }
+    pcb->th_attr |= TH_QUEUED;
+    cpu->cpu_nready++;
+}
+
+/* ------------------------------------------------------------ */
+static void cx_sched_runq_remove(PCB_t * pcb) {
+    struct cpu *cpu = pcb->th_home;
+
+    if (!CX_SCHED_IS_QUEUED(pcb))
+        return;
+
+    if (TH_GROUP_WAIT == (TH_GROUP_WAIT & pcb->th_attr)) {
+        queue_remove(&pcb->th_cold->grp_link);
+        pcb->th_attr &= ~(TH_QUEUED | TH_GROUP_WAIT);
+        return;
+    }
+
+    if (TH_PERIODIC == (TH_PERIODIC & pcb->th_attr)) {
+        pqueue_remove(&cpu->cpu_edf, &pcb->run_node);
+    } else {
+        pqueue_remove(&cpu->cpu_runq[pcb->th_prio], &pcb->run_node);
+        if (pqueue_empty(&cpu->cpu_runq[pcb->th_prio]))
+            cpu->cpu_runq_bitmap &= ~(1u << pcb->th_prio);
+    }
+    pcb->th_attr &= ~TH_QUEUED;
+    cpu->cpu_nready--;
+}
+
+/* ------------------------------------------------------------ */
+static PCB_t *cx_sched_runq_take(struct cpu *cpu) {
+    PCB_t *pcb;
+    u32 prio;
+
+    /*
+     * Periodic threads come first, the earliest deadline first
+     */
+    if (!pqueue_empty(&cpu->cpu_edf)) {
+        pcb = pqueue_entry(pqueue_first(&cpu->cpu_edf), PCB_t, run_node);
+        cx_sched_runq_remove(pcb);
+        return (pcb);
+    }
+
+    /*
+     * Then the thread of the highest level that has had the least
+     * virtual runtime.  Threads whose group was throttled after
+     * they were queued are moved off to wait for it.
+     */
+    do {
+        if (0 == cpu->cpu_runq_bitmap)
+            return (NULL);
+
+        prio = CX_SCHED_RUNQ_FIRST(cpu);
+        pcb = pqueue_entry(pqueue_first(&cpu->cpu_runq[prio]), PCB_t,
+                           run_node);
+        cx_sched_runq_remove(pcb);
+        if (pcb->th_group->g_throttled)
+            cx_sched_runq_add(pcb);
+    } while (CX_SCHED_IS_QUEUED(pcb));
+
+    if (pcb->th_vruntime > cpu->cpu_min_vruntime[prio])
+        cpu->cpu_min_vruntime[prio] = pcb->th_vruntime;
+
+    return (pcb);
+}
+
+/**
+ * Take a thread from the cpu with the most threads waiting, the
+ * next one of that cpu's highest priority queue.  Periodic threads
+ * stay on the cpu their time was reserved on.
+ */
+static PCB_t *cx_sched_runq_steal(struct cpu *cpu) {
+    struct cpu *victim;
+    PCB_t *pcb;
+    u32 prio;
+    u32 i;
 
+    do {
         /*
-         * Check to see if the thread needs to wake up
+         * Fibers stay on the cpu whose stack they use, so leave a
+         * cpu alone whose next thread is one
          */
-        if (TH_SLEEPING == (TH_SLEEPING & pcblist[i].th_state)) {
-            if (pcblist[i].sleep_time <= arch_get_mtime()) {
-                pcblist[i].th_state = TH_RUNNING;
-            }
+        victim = NULL;
+        for (i = 0; i < ARCH_NCPUS; i++) {
+            if ((&cpus[i] == cpu) || (0 == cpus[i].cpu_runq_bitmap) ||
+                ((NULL != victim) &&
+                 (cpus[i].cpu_nready <= victim->cpu_nready)))
+                continue;
+            pcb = pqueue_entry(pqueue_first(&cpus[i].cpu_runq
+                                            [CX_SCHED_RUNQ_FIRST(&cpus[i])]),
+                               PCB_t, run_node);
+            if (TH_FIBER != (TH_FIBER & pcb->th_attr))
+                victim = &cpus[i];
         }
+        if (NULL == victim)
+            return (NULL);
+
+        prio = CX_SCHED_RUNQ_FIRST(victim);
+        pcb = pqueue_entry(pqueue_first(&victim->cpu_runq[prio]), PCB_t,
+                           run_node);
+        cx_sched_runq_remove(pcb);
+        if (pcb->th_group->g_throttled)
+            cx_sched_runq_add(pcb);
+    } while (CX_SCHED_IS_QUEUED(pcb));
+
+    cx_sched_fair_move(pcb, cpu, prio);
+    pcb->th_home = cpu;
+    pcb->th_cold->th_migrations++;
+    cpu->cpu_steals++;
+
+    return (pcb);
+}
 
-        if (TH_RUNNING == pcblist[i].th_state) {
-            return (&pcblist[i]);
-        }
+/**
+ * Take the thread the last thread on this cpu yielded to, if it is
+ * still waiting on a run queue and nothing that must come first is
+ * waiting here
+ */
+static PCB_t *cx_sched_runq_handoff(struct cpu *cpu) {
+    PCB_t *pcb = cpu->cpu_handoff;
+
+    if (NULL == pcb)
+        return (NULL);
+    cpu->cpu_handoff = NULL;
+
+    if ((!CX_SCHED_IS_QUEUED(pcb)) ||
+        (TH_GROUP_WAIT == (TH_GROUP_WAIT & pcb->th_attr)) ||
+        (TH_PERIODIC == (TH_PERIODIC & pcb->th_attr)) ||
+        ((TH_FIBER == (TH_FIBER & pcb->th_attr)) && (cpu != pcb->th_home)) ||
+        (!pqueue_empty(&cpu->cpu_edf)) ||
+        ((0 != cpu->cpu_runq_bitmap) &&
+         ((u32) CX_SCHED_RUNQ_FIRST(cpu) < pcb->th_prio)))
+        return (NULL);
+
+    cx_sched_runq_remove(pcb);
+    if (cpu != pcb->th_home) {
+        cx_sched_fair_move(pcb, cpu, pcb->th_prio);
+        pcb->th_home = cpu;
+        pcb->th_cold->th_migrations++;
+    }
+    cpu->cpu_handoffs++;
+
+    return (pcb);
+}
+
+/**
+ * Pick a cpu for a new thread.  A parked cpu if there is one,
+ * otherwise the one with the fewest threads waiting.
+ */
+static struct cpu *cx_sched_pick_cpu(void) {
+    struct cpu *cpu;
+    u32 i;
+
+    cpu = cx_cpu_find_idle();
+    if (NULL != cpu)
+        return (cpu);
+
+    cpu = &cpus[0];
+    for (i = 1; i < ARCH_NCPUS; i++) {
+        if (cpus[i].cpu_nready < cpu->cpu_nready)
+            cpu = &cpus[i];
+    }
+
+    return (cpu);
+}
+
+/* ------------------------------------------------------------ */
+static void cx_sched_idle(void) {
+    u64 expire;
+    u64 now;
+    i32 timeout;
 
-    } while (i != pid);
+    /*
+     * Give an idle hook a slice instead of parking.  The caller
+     * looks for threads again before the next one.
+     */
+    if (cx_idle_run())
+        return;
 
     /*
-     * Unable to find a running process
+     * Wait no longer than the next timer deadline, or forever
+     * if there are no timers.  Input will also end the wait.
      */
-    return (NULL);
+    timeout = -1;
+    if (0 == cx_timer_next(&expire)) {
+        now = arch_get_mtime();
+        timeout = (expire > now) ? (i32) (expire - now) : 0;
+    }
+
+    cx_cpu_idle(timeout);
+}
+
+/* ------------------------------------------------------------ */
+static void cx_sched_sleep_expired(void *arg) {
+    PCB_t *pcb = (PCB_t *) arg;
+
+    pcb->th_attr &= ~TH_THROTTLED;
+
+    /*
+     * Time to wake up
+     */
+    (void) cx_thread_set_state_pcb(pcb, TH_RUNNING);
+}
+
+/* ------------------------------------------------------------ */
+static void cx_sched_alarm_expired(void *arg) {
+    PCB_t *pcb = (PCB_t *) arg;
+
+    pcb->th_cold->alarm_time = 0;
+    cx_kill(PCB_GETID(pcb), SIGALRM);
+}
+
+/* ------------------------------------------------------------ */
+/* XXXXXXXXXX MAYBE ADD THIS TO cx_sched_schedule XXXXXXXXXXXXXXXXXXXXXXXXXXXXX*/
+static PCB_t *cx_sched_get_next_thread(void) {
+    struct cpu *cpu = CX_CPU_SELF();
+    PCB_t *next;
+    u64 cycles;
+    u64 run;
+
+    /*
+     * Wake up any threads whose time has come.  The timers are
+     * kept in deadline order, so this only looks at the ones
+     * that are due.
+     */
+    cx_timer_expire(arch_get_mtime());
+
+    /*
+     * Another cpu asked for the thread giving up this one to
+     * be ended.  It is off its stack now, or will be once the
+     * switch is done.
+     */
+    if ((NULL != current_pcb) &&
+        (TH_END_PEND == (TH_END_PEND & current_pcb->th_attr))) {
+        (void) cx_thread_end(PCB_GETID(current_pcb));
+    }
+
+    /*
+     * Charge the thread giving up the cpu for the time it ran.
+     * Its fair share goes by the cpu time of this cpu, so a
+     * stretch the host spent running something else is not held
+     * against it.  A periodic thread that has used up its budget
+     * waits for its next period.
+     */
+    run = arch_get_cpu_cycles();
+    if ((NULL != current_pcb) && (!CX_SCHED_IS_PCB_DEAD(current_pcb))) {
+        cycles = cx_sched_thread_cycles(current_pcb);
+        cx_sched_fair_charge(current_pcb, run - cpu->cpu_run_stamp);
+        cx_group_charge(current_pcb, cycles);
+        if ((TH_PERIODIC == (TH_PERIODIC & current_pcb->th_attr)) &&
+            (TH_RUNNING == current_pcb->th_state))
+            cx_sched_edf_charge(current_pcb, cycles);
+    }
+    cpu->cpu_run_stamp = run;
+
+    /*
+     * The thread giving up the cpu goes back on the run queue if
+     * it is still able to run
+     */
+    if ((NULL != current_pcb) &&
+        (TH_RUNNING == current_pcb->th_state) &&
+        (!CX_SCHED_IS_QUEUED(current_pcb))) {
+        cx_sched_runq_add(current_pcb);
+        if (CX_CPU_SELF() != current_pcb->th_home)
+            cx_cpu_kick(current_pcb->th_home);
+    }
+
+    /*
+     * Take the next thread of the highest priority run queue
+     * of this cpu.  If it has none, take one from
+     * another cpu.  NULL if no thread is able to run.
+     */
+    next = cx_sched_runq_handoff(CX_CPU_SELF());
+    if (NULL == next)
+        next = cx_sched_runq_take(CX_CPU_SELF());
+    if ((NULL == next) && (1 < ARCH_NCPUS))
+        next = cx_sched_runq_steal(CX_CPU_SELF());
+
+    return (next);
+}
+
+/* ------------------------------------------------------------ */
+static void cx_sched_edf_charge(PCB_t * pcb, u64 cycles) {
+    if (cycles - pcb->th_cold->th_job_cycles < pcb->th_cold->th_budget)
+        return;
+
+    /*
+     * The job did not get done within its budget, so it missed
+     * its deadline or will.  What is left of it runs in the next
+     * period, on the budget of that period.
+     */
+    pcb->th_cold->th_throttles++;
+    pcb->th_cold->th_misses++;
+    cx_sched_edf_next(pcb, arch_get_mtime());
+    pcb->th_cold->th_job_cycles = cycles;
+    pcb->th_attr |= TH_THROTTLED;
+    pcb->th_cold->sleep_time = pcb->th_cold->th_release;
+    cx_thread_set_state_pcb(pcb, TH_SLEEPING);
+}
+
+/*
+ * Move a periodic thread on to its next period.  The periods are
+ * kept in step with the first unless the thread is so late that
+ * the next one has started already; then it starts now.
+ */
+static void cx_sched_edf_next(PCB_t * pcb, u64 now) {
+    struct pcb_cold *cold = pcb->th_cold;
+
+    cold->th_release += cold->th_period;
+    if (cold->th_release < now)
+        cold->th_release = now;
+    cold->th_deadline = cold->th_release + cold->th_rel_deadline;
+}
+
+/*
+ * Give back the cpu time reserved by a periodic thread.  It must
+ * be off the run queues.
+ */
+static void cx_sched_edf_leave(PCB_t * pcb) {
+    if (TH_PERIODIC != (TH_PERIODIC & pcb->th_attr))
+        return;
+
+    pcb->th_home->cpu_edf_util -= pcb->th_cold->th_util;
+    pcb->th_cold->th_util = 0;
+    pcb->th_attr &= ~(TH_PERIODIC | TH_THROTTLED);
+}
+
+/*
+ * Add the cpu time, in cycles, run since the last charge to the
+ * virtual runtime, scaled down by the weight of the thread
+ */
+static void cx_sched_fair_charge(PCB_t * pcb, u64 cycles) {
+    pcb->th_vruntime += cycles * CX_WEIGHT_DEFAULT / pcb->th_weight;
+}
+
+/*
+ * A thread that becomes ready again starts no further behind the
+ * others of its level than the wake credit
+ */
+static void cx_sched_fair_place(PCB_t * pcb) {
+    u64 floor;
+    u64 credit;
+
+    floor = pcb->th_home->cpu_min_vruntime[pcb->th_prio];
+    credit = (u64) FAIR_WAKE_CREDIT * arch_get_cycle_rate();
+    floor = (floor > credit) ? floor - credit : 0;
+    if (pcb->th_vruntime < floor)
+        pcb->th_vruntime = floor;
+}
+
+/*
+ * Keep the place of a thread relative to the others of its level
+ * when it moves to another cpu or level.  It must be off the run
+ * queues.
+ */
+static void cx_sched_fair_move(PCB_t * pcb, struct cpu *cpu, u32 prio) {
+    u64 from = pcb->th_home->cpu_min_vruntime[pcb->th_prio];
+    u64 to = cpu->cpu_min_vruntime[prio];
+
+    if (pcb->th_vruntime + to > from)
+        pcb->th_vruntime = pcb->th_vruntime + to - from;
+    else
+        pcb->th_vruntime = 0;
+}
+
+/*
+ * Count a wait of @p cycles from wakeup to running for the thread
+ * and for all threads
+ */
+static void cx_sched_lat_record(PCB_t * pcb, u64 cycles) {
+    u32 bucket;
+
+    bucket = (cycles < 2) ? 0 : 63 - __builtin_clzll(cycles);
+    if (LAT_BUCKETS <= bucket)
+        bucket = LAT_BUCKETS - 1;
+
+    if (!CX_SCHED_IS_FIBER(pcb)) {
+        pcb->th_cold->th_lat.lh_count[bucket]++;
+        pcb->th_cold->th_lat.lh_samples++;
+        if (cycles > pcb->th_cold->th_lat.lh_max)
+            pcb->th_cold->th_lat.lh_max = cycles;
+    }
+
+    sched_lat.lh_count[bucket]++;
+    sched_lat.lh_samples++;
+    if (cycles > sched_lat.lh_max)
+        sched_lat.lh_max = cycles;
 }
 
 static void dummy_handler(i32 val) {
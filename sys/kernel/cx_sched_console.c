@@ -33,19 +33,38 @@
 #include <chrysalix.h>
 #include "arch_context.h"
 #include "cx_sched.h"
+#include "cx_stack.h"
 
 /************************************************************************************
  * Defines
  */
 #define THREAD_GETID()          ( (i32)((PCB_t *)current_pcb - (PCB_t *)pcblist) )
 
+    /** Most threads schedbench starts */
+#define BENCH_MAX_THREADS       16384
+
+    /** Times schedbench scans the PCBs */
+#define BENCH_SCANS             100
+
 /************************************************************************************
  * Prototypes
  */
+static void print_state(PCB_t * pcb);
+static void print_stack(PCB_t * pcb);
 static i32 do_ps(i32 argc, char **argv);
+static i32 do_top(i32 argc, char **argv);
 static i32 do_kill(i32 argc, char **argv);
 static i32 do_pdump(i32 argc, char **argv);
 static i32 do_sigtest(i32 argc, char **argv);
+static i32 do_prio(i32 argc, char **argv);
+static i32 do_weight(i32 argc, char **argv);
+static i32 do_cpus(i32 argc, char **argv);
+static i32 do_preempt(i32 argc, char **argv);
+static void print_nsecs(u32 nsecs);
+static void print_lat(struct lat_hist *lh);
+static i32 do_lat(i32 argc, char **argv);
+static void bench_yield(i32 rounds);
+static i32 do_schedbench(i32 argc, char **argv);
 
 /************************************************************************************
  * Globals
@@ -53,14 +72,34 @@ static i32 do_sigtest(i32 argc, char **argv);
 
 static const struct console_fnc g_console_sched_fncs[] = {
     { "ps", do_ps },
-    { "top", do_ps },
+    { "top", do_top },
     { "kill", do_kill },
     { "pdump", do_pdump },
     { "sigtest", do_sigtest },
+    { "prio", do_prio },
+    { "weight", do_weight },
+    { "cpus", do_cpus },
+    { "preempt", do_preempt },
+    { "lat", do_lat },
+    { "schedbench", do_schedbench },
 };
 
 static struct console_fnc_list g_console_sched_fnclist;
 
+    /** Threads started by schedbench, held back until all are started */
+static i32 bench_pids[BENCH_MAX_THREADS];
+static struct semaphore bench_go;
+
+    /** Counters of one thread as top saw them */
+struct top_sample
+{
+    u64                  cycles;
+    u64                  total;
+    u32                  switches;
+    u32                  wakeups;
+    u32                  misses;
+};
+
 /************************************************************************************
  * Functions
  */
@@ -72,32 +111,158 @@ void cx_sched_console_init(void) {
     CX_CONSOLE_CREATE(g_console_sched_fncs, g_console_sched_fnclist);
 }
 
+static void print_state(PCB_t * pcb) {
+    if (TH_RUNNING == (pcb->th_state & TH_RUNNING))
+        printf("%c", 'R');
+    if (TH_SLEEPING == (pcb->th_state & TH_SLEEPING))
+        printf("%c", 'S');
+    if (TH_SUSPENDED == (pcb->th_state & TH_SUSPENDED))
+        printf("%c", 'W');
+    if (TH_SEMWAIT == (pcb->th_state & TH_SEMWAIT))
+        printf("%c", 'M');
+    if (TH_JOINING == (pcb->th_state & TH_JOINING))
+        printf("%c", 'J');
+    if (TH_HALTED == (pcb->th_state & TH_HALTED))
+        printf("%c", 'H');
+}
+
+/*
+ * Most of the stack used if it is checked, otherwise only its size.
+ * For a fiber, the bytes it had on the shared stack when last
+ * copied off it.
+ */
+static void print_stack(PCB_t * pcb) {
+    if (TH_FIBER == (TH_FIBER & pcb->th_attr))
+        printf("%u/%u*", pcb->th_cold->th_image_len,
+               pcb->th_cold->stack_info.stack_size);
+    else if (TH_STACK_FILLED == (TH_STACK_FILLED & pcb->th_attr))
+        printf("%u/%u", cx_stack_used(pcb),
+               pcb->th_cold->stack_info.stack_size);
+    else
+        printf("-/%u", pcb->th_cold->stack_info.stack_size);
+    if (TH_STACK_WARNED == (TH_STACK_WARNED & pcb->th_attr))
+        printf("%c", '!');
+}
+
 static i32 do_ps(i32 argc _UNUSED_, char **argv _UNUSED_) {
     i32 pid;
     PCB_t *pcb;
 
-    printf("PID NAME STATE\n");
-    for (pid = 0; pid < ARCH_MAX_THREADS; pid++) {
+    printf("PID PRI GRP NAME STATE STACK\n");
+    for (pid = 0; (u32) pid < cx_sched_npids(); pid++) {
+        if (CX_SCHED_IS_PID_DEAD(pid))
+            continue;
         pcb = cx_get_pcb(pid);
-        if (!CX_SCHED_IS_PCB_DEAD(pcb)) {
-            printf("%d %s ", pid, pcb->th_name);
-            if (TH_RUNNING == (pcb->th_state & TH_RUNNING))
-                printf("%c", 'R');
-            if (TH_SLEEPING == (pcb->th_state & TH_SLEEPING))
-                printf("%c", 'S');
-            if (TH_SUSPENDED == (pcb->th_state & TH_SUSPENDED))
-                printf("%c", 'W');
-            if (TH_SEMWAIT == (pcb->th_state & TH_SEMWAIT))
-                printf("%c", 'M');
-            if (TH_HALTED == (pcb->th_state & TH_HALTED))
-                printf("%c", 'H');
-            printf("\n");
-        }
+        printf("%d %u %d %s ", pid, pcb->th_prio,
+               cx_group_id(pcb->th_group), pcb->th_cold->th_name);
+        print_state(pcb);
+        printf(" ");
+        print_stack(pcb);
+        printf("\n");
     }
+
+    /*
+     * What each group has used
+     */
+    printf("\n");
+    cx_group_print();
     return (0);
 }
 
 
+static i32 do_top(i32 argc, char **argv) {
+    i32 pid;
+    PCB_t *pcb;
+    struct top_sample *ts;
+    u32 npids, size;
+    u32 secs, count, n;
+    u64 start, elapsed, cycles;
+    u32 tenths;
+    unsigned long s;
+
+    secs = 1;
+    count = 1;
+    if (argc > 1)
+        secs = (u32) atoi(argv[1]);
+    if (argc > 2)
+        count = (u32) atoi(argv[2]);
+    if (0 == secs)
+        secs = 1;
+
+    for (n = 0; n < count; n++) {
+        /*
+         * Threads started after the first sample show up in the
+         * next round
+         */
+        npids = cx_sched_npids();
+        size = npids * sizeof(struct top_sample);
+        ts = (struct top_sample *) arch_mem_map(size);
+        if (NULL == ts) {
+            printf("Out of memory\n");
+            return (-1);
+        }
+
+        s = cx_intsoff();
+        start = arch_get_cycles();
+        for (pid = 0; (u32) pid < npids; pid++) {
+            if (CX_SCHED_IS_PID_DEAD(pid))
+                continue;
+            pcb = cx_get_pcb(pid);
+            ts[pid].cycles = cx_sched_thread_cycles(pcb);
+            ts[pid].switches = pcb->th_cold->th_nvcsw +
+                pcb->th_cold->th_nivcsw;
+            ts[pid].wakeups = pcb->th_cold->th_wakeups;
+            ts[pid].misses = pcb->th_cold->th_misses;
+        }
+        cx_intson(s);
+
+        cx_msleep(secs * 1000);
+
+        /*
+         * Work out the figures for the interval with the lock
+         * held, then print them without it
+         */
+        s = cx_intsoff();
+        elapsed = arch_get_cycles() - start;
+        for (pid = 0; (u32) pid < npids; pid++) {
+            if (CX_SCHED_IS_PID_DEAD(pid))
+                continue;
+            pcb = cx_get_pcb(pid);
+            cycles = cx_sched_thread_cycles(pcb);
+            ts[pid].total = cycles;
+            ts[pid].cycles = (cycles >= ts[pid].cycles) ?
+                cycles - ts[pid].cycles : cycles;
+            ts[pid].switches = pcb->th_cold->th_nvcsw +
+                pcb->th_cold->th_nivcsw - ts[pid].switches;
+            ts[pid].wakeups = pcb->th_cold->th_wakeups - ts[pid].wakeups;
+            ts[pid].misses = pcb->th_cold->th_misses - ts[pid].misses;
+        }
+        cx_intson(s);
+
+        printf("PID NAME STATE %s TIME SW/s WAKE/s MISS\n", "CPU%");
+        for (pid = 0; (u32) pid < npids; pid++) {
+            if (CX_SCHED_IS_PID_DEAD(pid))
+                continue;
+            pcb = cx_get_pcb(pid);
+
+            tenths = (u32) (ts[pid].cycles * 1000 / elapsed);
+            printf("%d %s ", pid, pcb->th_cold->th_name);
+            print_state(pcb);
+            printf(" %u.%u %u %u %u ", tenths / 10, tenths % 10,
+                   (u32) (ts[pid].total / arch_get_cycle_rate()),
+                   ts[pid].switches / secs, ts[pid].wakeups / secs);
+            if (TH_PERIODIC == (TH_PERIODIC & pcb->th_attr))
+                printf("%u\n", ts[pid].misses);
+            else
+                printf("-\n");
+        }
+        printf("\n");
+
+        arch_mem_unmap(ts, size);
+    }
+    return (0);
+}
+
 static i32 do_kill(i32 argc, char **argv) {
     u32 sig;
     i32 pid;
@@ -151,38 +316,61 @@ static i32 do_pdump(i32 argc, char **argv) {
     pid = atoi(argv[1]);
     pcb = cx_get_pcb(pid);
     if (NULL != pcb) {
-        printf("Pdump %s - PID %u\n\n", pcb->th_name, pid);
-        printf("&Ctx = 0x%X size %u\n", (uintptr_t) & pcb->ctx,
-               sizeof(struct context));
-        arch_context_print(&pcb->ctx);
+        printf("Pdump %s - PID %u\n\n", pcb->th_cold->th_name, pid);
+        if (CX_SCHED_IS_FIBER(pcb)) {
+            printf("Fiber of cpu %u\n", pcb->th_home->cpu_id);
+        } else {
+            printf("&Ctx = 0x%X size %u\n", (uintptr_t) & pcb->th_cold->ctx,
+                   sizeof(struct context));
+            arch_context_print(&pcb->th_cold->ctx);
+        }
 
         printf("\n"
                "Fnc = 0x%X ( arg:%d )\n",
-               (uintptr_t) pcb->entry_info.fnc, pcb->entry_info.arg);
+               (uintptr_t) pcb->th_cold->entry_info.fnc,
+               pcb->th_cold->entry_info.arg);
         printf("Stk = 0x%X size:%u\n",
-               pcb->stack_info.stack, pcb->stack_info.stack_size);
+               pcb->th_cold->stack_info.stack,
+               pcb->th_cold->stack_info.stack_size);
+        printf("Stk used = ");
+        print_stack(pcb);
+        printf("\n");
         printf("Attr = 0x%X\n", pcb->th_attr);
-        printf("NTR  = %u\n", pcb->num_times_run);
-        printf("Wait Value = %u\n", pcb->wait_val);
-        printf("UI = %u\n", pcb->uistream);
+        printf("Prio = %u\n", pcb->th_prio);
+        printf("Weight = %u, virtual run time %u msecs\n", pcb->th_weight,
+               (u32) (pcb->th_vruntime / arch_get_cycle_rate()));
+        if (NULL != pcb->th_cpu)
+            printf("Cpu  = %u\n", pcb->th_cpu->cpu_id);
+        else
+            printf("Cpu  = -\n");
+        printf("Migrations = %u\n", pcb->th_cold->th_migrations);
+        printf("NTR  = %u\n", pcb->th_cold->num_times_run);
+        printf("Run time = %u msecs\n",
+               (u32) (pcb->th_cycles / arch_get_cycle_rate()));
+        printf("Switches = %u voluntary, %u preempted\n",
+               pcb->th_cold->th_nvcsw, pcb->th_cold->th_nivcsw);
+        printf("Wakeups = %u\n", pcb->th_cold->th_wakeups);
+        if (TH_PERIODIC == (TH_PERIODIC & pcb->th_attr)) {
+            printf("Period = %u msecs, budget %u, deadline %u\n",
+                   pcb->th_cold->th_period,
+                   (u32) (pcb->th_cold->th_budget / arch_get_cycle_rate()),
+                   pcb->th_cold->th_rel_deadline);
+            printf("Deadline misses = %u, %u out of budget\n",
+                   pcb->th_cold->th_misses, pcb->th_cold->th_throttles);
+        }
+        printf("Wait Value = %u\n", pcb->th_cold->wait_val);
+        printf("UI = %u\n", pcb->th_cold->uistream);
 
-        (void) sem_getvalue(&pcb->th_port.sem_send, &sval);
-        printf("Msgs = %d\n", sval * (-1) + 1);
+        if (!CX_SCHED_IS_FIBER(pcb)) {
+            (void) sem_getvalue(&pcb->th_cold->th_port.sem_send, &sval);
+            printf("Msgs = %d\n", sval * (-1) + 1);
+        }
 
         printf("State = ");
         if (CX_SCHED_IS_PCB_DEAD(pcb))
             printf("Dead\n");
         else {
-            if (TH_RUNNING == (pcb->th_state & TH_RUNNING))
-                printf("%c", 'R');
-            if (TH_SLEEPING == (pcb->th_state & TH_SLEEPING))
-                printf("%c", 'S');
-            if (TH_SUSPENDED == (pcb->th_state & TH_SUSPENDED))
-                printf("%c", 'W');
-            if (TH_SEMWAIT == (pcb->th_state & TH_SEMWAIT))
-                printf("%c", 'M');
-            if (TH_HALTED == (pcb->th_state & TH_HALTED))
-                printf("%c", 'H');
+            print_state(pcb);
             printf("\n");
         }
     } else {
@@ -209,3 +397,267 @@ static i32 do_sigtest(i32 argc, char **argv) {
     return (0);
 
 }
+
+static i32 do_prio(i32 argc, char **argv) {
+    i32 pid;
+
+    if (argc < 2) {
+        printf("%s <pid> [level 0-%d]\n", argv[0], CX_PRIO_LOWEST);
+        return (-1);
+    }
+
+    pid = atoi(argv[1]);
+    if (argc > 2) {
+        if (0 > cx_thread_setprio(pid, (u32) atoi(argv[2]))) {
+            printf("Unable to set priority of pid %d\n", pid);
+            return (-1);
+        }
+    }
+
+    printf("PID %d priority %d\n", pid, cx_thread_getprio(pid));
+    return (0);
+}
+
+static i32 do_weight(i32 argc, char **argv) {
+    i32 pid;
+
+    if (argc < 2) {
+        printf("%s <pid> [weight 1-%d]\n", argv[0], CX_WEIGHT_MAX);
+        return (-1);
+    }
+
+    pid = atoi(argv[1]);
+    if (argc > 2) {
+        if (0 > cx_thread_setweight(pid, (u32) atoi(argv[2]))) {
+            printf("Unable to set weight of pid %d\n", pid);
+            return (-1);
+        }
+    }
+
+    printf("PID %d weight %d\n", pid, cx_thread_getweight(pid));
+    return (0);
+}
+
+static i32 do_cpus(i32 argc _UNUSED_, char **argv _UNUSED_) {
+    struct cpu *cpu;
+    PCB_t *pcb;
+    i32 pid;
+    u32 i;
+    u32 migrations;
+
+    printf("CPU PID READY STEALS PREEMPTS HANDOFFS EDF\n");
+    for (i = 0; i < ARCH_NCPUS; i++) {
+        cpu = &cpus[i];
+        printf("%u ", cpu->cpu_id);
+        if (NULL == cpu->cpu_current)
+            printf("- ");
+        else
+            printf("%d ", cpu->cpu_current->th_pid);
+        printf("%u %u %u %u %u.%u\n", cpu->cpu_nready, cpu->cpu_steals,
+               cpu->cpu_preempts, cpu->cpu_handoffs,
+               cpu->cpu_edf_util / 10, cpu->cpu_edf_util % 10);
+    }
+
+    migrations = 0;
+    for (pid = 0; (u32) pid < cx_sched_npids(); pid++) {
+        if (CX_SCHED_IS_PID_DEAD(pid))
+            continue;
+        pcb = cx_get_pcb(pid);
+        migrations += pcb->th_cold->th_migrations;
+    }
+    printf("Migrations of live threads: %u\n", migrations);
+
+    return (0);
+}
+
+static i32 do_preempt(i32 argc, char **argv) {
+    if (argc > 1)
+        cx_preempt_set((u32) atoi(argv[1]));
+
+    if (0 == cx_preempt_get())
+        printf("Preemption off\n");
+    else
+        printf("Time slice %u msecs\n", cx_preempt_get());
+    return (0);
+}
+
+/*
+ * A time in the largest unit that keeps a few digits
+ */
+static void print_nsecs(u32 nsecs) {
+    if (nsecs < 10000)
+        printf("%uns", nsecs);
+    else if (nsecs < 10000000)
+        printf("%uus", nsecs / 1000);
+    else
+        printf("%ums", nsecs / 1000000);
+}
+
+/*
+ * Wakeups, percentiles and longest wait of a latency histogram
+ */
+static void print_lat(struct lat_hist *lh) {
+    printf("%u ", lh->lh_samples);
+    print_nsecs(cx_sched_lat_nsecs(cx_sched_lat_pct(lh, 5000)));
+    printf(" ");
+    print_nsecs(cx_sched_lat_nsecs(cx_sched_lat_pct(lh, 9900)));
+    printf(" ");
+    print_nsecs(cx_sched_lat_nsecs(cx_sched_lat_pct(lh, 9990)));
+    printf(" ");
+    print_nsecs(cx_sched_lat_nsecs(lh->lh_max));
+    printf("\n");
+}
+
+static i32 do_lat(i32 argc, char **argv) {
+    struct lat_hist *lh;
+    PCB_t *pcb;
+    i32 pid;
+    u32 i;
+
+    if ((argc > 1) && (0 == strncmp(argv[1], "reset", 6))) {
+        cx_sched_lat_reset();
+        return (0);
+    }
+
+    /*
+     * The histogram of one thread
+     */
+    if (argc > 1) {
+        pid = atoi(argv[1]);
+        pcb = cx_get_pcb(pid);
+        if ((NULL == pcb) || (CX_SCHED_IS_PCB_DEAD(pcb))) {
+            printf("No pid %d\n", pid);
+            return (-1);
+        }
+        if (CX_SCHED_IS_FIBER(pcb)) {
+            printf("Fibers only count towards all threads\n");
+            return (-1);
+        }
+        lh = &pcb->th_cold->th_lat;
+        printf("UPTO WAKEUPS\n");
+        for (i = 0; i < LAT_BUCKETS; i++) {
+            if (0 == lh->lh_count[i])
+                continue;
+            print_nsecs(cx_sched_lat_nsecs((2ULL << i) - 1));
+            printf(" %u\n", lh->lh_count[i]);
+        }
+        printf("WAKEUPS P50 P99 P999 MAX\n");
+        print_lat(lh);
+        return (0);
+    }
+
+    printf("PID NAME WAKEUPS P50 P99 P999 MAX\n");
+    printf("- all ");
+    print_lat(&sched_lat);
+    for (pid = 0; (u32) pid < cx_sched_npids(); pid++) {
+        if (CX_SCHED_IS_PID_DEAD(pid))
+            continue;
+        pcb = cx_get_pcb(pid);
+        if ((!CX_SCHED_IS_FIBER(pcb)) &&
+            (0 != pcb->th_cold->th_lat.lh_samples)) {
+            printf("%d %s ", pid, pcb->th_cold->th_name);
+            print_lat(&pcb->th_cold->th_lat);
+        }
+    }
+    return (0);
+}
+
+static void bench_yield(i32 rounds) {
+    i32 i;
+
+    sem_wait(&bench_go);
+    for (i = 0; i < rounds; i++)
+        cx_yield();
+}
+
+/*
+ * Time what the scheduler does with many threads: scanning all the
+ * PCBs the way ps and top do, and switching among the threads
+ */
+static i32 do_schedbench(i32 argc, char **argv) {
+    PCB_t *pcb;
+    u64 start;
+    u64 cycles;
+    u64 best;
+    u32 nthreads;
+    u32 rounds;
+    u32 npids;
+    u32 ready;
+    u32 scan;
+    u32 i;
+    i32 pid;
+
+    nthreads = (argc > 1) ? (u32) atoi(argv[1]) : 1000;
+    rounds = (argc > 2) ? (u32) atoi(argv[2]) : 100;
+    if ((0 == nthreads) || (BENCH_MAX_THREADS < nthreads) || (0 == rounds)) {
+        printf("%s [threads 1-%d] [yields]\n", argv[0], BENCH_MAX_THREADS);
+        return (-1);
+    }
+
+    sem_init(&bench_go, 0);
+    for (i = 0; i < nthreads; i++) {
+        bench_pids[i] = cx_thread_start("bench", NULL, ARCH_MIN_STACK_SIZE,
+                                        bench_yield, (i32) rounds);
+        if (0 > bench_pids[i]) {
+            printf("Unable to start thread %u\n", i);
+            nthreads = i;
+            rounds = 0;
+            break;
+        }
+    }
+
+    /*
+     * Scan the threads while they wait to go, once through their
+     * PCBs and once through their states by pid, the way ps and
+     * top do.  The fastest scan is kept, the one least disturbed
+     * by the host.
+     */
+    npids = cx_sched_npids();
+    best = ~0ULL;
+    for (scan = 0; scan < BENCH_SCANS; scan++) {
+        ready = 0;
+        start = arch_get_cycles();
+        for (pid = 0; (u32) pid < npids; pid++) {
+            pcb = cx_get_pcb(pid);
+            if ((!CX_SCHED_IS_PCB_DEAD(pcb)) &&
+                (TH_RUNNING == (TH_RUNNING & pcb->th_state)))
+                ready++;
+        }
+        cycles = arch_get_cycles() - start;
+        if (cycles < best)
+            best = cycles;
+    }
+    printf("PCB %u bytes, scan %u pids: %u cycles per 100 PCBs "
+           "(%u ready)\n", (u32) sizeof(PCB_t), npids,
+           (u32) (best * 100 / npids), ready);
+
+    best = ~0ULL;
+    for (scan = 0; scan < BENCH_SCANS; scan++) {
+        ready = 0;
+        start = arch_get_cycles();
+        for (pid = 0; (u32) pid < npids; pid++) {
+            if ((!CX_SCHED_IS_PID_DEAD(pid)) &&
+                (TH_RUNNING == (TH_RUNNING & pid_state[pid])))
+                ready++;
+        }
+        cycles = arch_get_cycles() - start;
+        if (cycles < best)
+            best = cycles;
+    }
+    printf("States by pid: %u cycles per 100 pids (%u ready)\n",
+           (u32) (best * 100 / npids), ready);
+
+    /*
+     * Let them all go and wait for them to finish their yields
+     */
+    start = arch_get_cycles();
+    for (i = 0; i < nthreads; i++)
+        sem_post(&bench_go);
+    for (i = 0; i < nthreads; i++)
+        cx_thread_join(bench_pids[i], NULL);
+    cycles = arch_get_cycles() - start;
+    if (0 != rounds)
+        printf("%u threads x %u yields: %u cycles per yield\n", nthreads,
+               rounds, (u32) (cycles / ((u64) nthreads * rounds)));
+    return (0);
+}
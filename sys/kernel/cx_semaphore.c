@@ -81,6 +81,7 @@ i32 sem_init(struct semaphore *sem, i32 value) {
      * Initialize semaphore
      */
     queue_init(&sem->sem_q);
+    queue_init(&sem->sem_tasks);
     sem->value = value;
 
     return (0);
@@ -112,6 +113,11 @@ i32 sem_post(struct semaphore *sem) {
             if (NULL != q_elem) {
                 pcb = queue_entry(q_elem, PCB_t, sem_link);
                 (void) cx_thread_set_state_pcb(pcb, TH_RUNNING);
+            } else {
+                q_elem = dequeue(&sem->sem_tasks);
+                if (NULL != q_elem)
+                    cx_task_grant(queue_entry(q_elem, struct cx_task,
+                                              tk_link));
             }
         }
 
@@ -39,9 +39,21 @@
  */
 i32 cx_alarm(i32 msec) {
     PCB_t *current_pcb;
+    i32 s;
 
+    /*
+     * Fibers have no alarm
+     */
     current_pcb = cx_get_current_pcb();
-    current_pcb->alarm_time = (u64) (msec) + arch_get_mtime();
+    if (CX_SCHED_IS_FIBER(current_pcb)) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    s = cx_intsoff();
+    current_pcb->th_cold->alarm_time = (u64) (msec) + arch_get_mtime();
+    cx_sched_requeue(current_pcb);
+    cx_intson(s);
     return (0);
 }
 
@@ -0,0 +1,430 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * @file cx_stack.c
+ *      Thread stacks
+ *
+ * Stacks the kernel allocates for threads are mapped from the host,
+ * each with an inaccessible guard page below it so that running off
+ * the end faults instead of corrupting whatever lies next to it.
+ * The host only backs the pages a thread actually touches, so a big
+ * stack costs little until it is used.
+ *
+ * Sizes are rounded up to a power of two.  When a thread ends, its
+ * stack is kept in a small cache for its size and handed to the
+ * next thread that needs one that size, so threads that come and go
+ * do not map and unmap every time.
+ *
+ * Stack checking fills the stack of each new thread with a pattern.
+ * The pattern left untouched at the low end shows the deepest the
+ * thread has gone, and a thread that eats into the last few bytes
+ * of the pattern is warned about when it gives up the cpu.  Filling
+ * touches every page, so the host has to back the whole stack; it
+ * is off unless asked for.
+ */
+
+/************************************************************************************
+ * Includes
+ */
+#include <chrysalix.h>
+#include "arch_context.h"
+#include "cx_sched.h"
+#include "cx_stack.h"
+
+/************************************************************************************
+ * Defines
+ */
+    /** Smallest size, ARCH_MIN_STACK_SIZE, and up to 512 times that */
+#define STACK_CLASSES           10
+
+    /** Most stacks kept for reuse in one size */
+#define STACK_CACHE_MAX         64
+
+    /** Keep about this many bytes of stacks of one size for reuse */
+#define STACK_CACHE_BYTES       (1024*1024)
+
+    /** Byte new stacks are filled with when checking */
+#define STACK_FILL              0xcd
+
+    /** Bytes of the pattern looked at to see if the margin is used */
+#define STACK_PROBE             8
+
+/************************************************************************************
+ * Structures
+ */
+
+/**
+ * Stacks of one size.  sc_cache is a ring with the most recently
+ * freed stack at sc_head - 1.  New threads get the most recently
+ * freed one, which is the most likely to still be in the cache;
+ * when the ring is full the oldest one is unmapped.
+ */
+struct stack_class
+{
+    u8                     *sc_cache[STACK_CACHE_MAX];
+    u32                     sc_head;
+    u32                     sc_count;
+    u32                     sc_limit;
+    u32                     sc_size;
+    u32                     sc_mapped;
+    u32                     sc_reused;
+};
+
+/************************************************************************************
+ * Prototypes
+ */
+static struct stack_class *cx_stack_class(u32 size);
+static i32 do_stacks(i32 argc, char **argv);
+
+/************************************************************************************
+ * Globals
+ */
+static struct stack_class stack_classes[STACK_CLASSES];
+
+    /** Nonzero to fill the stacks of new threads */
+static u32 stack_check = ARCH_STACK_CHECK;
+
+    /** Bytes left at the end of a stack when a thread is warned about */
+static u32 stack_margin = ARCH_STACK_MARGIN;
+
+static const struct console_fnc g_console_fncs[] = {
+    { "stacks", do_stacks }
+};
+
+static struct console_fnc_list g_console_fnclist;
+
+/************************************************************************************
+ * Functions
+ */
+
+/**
+ *      Set up the size classes and register the console command
+ *
+ * @ingroup cxgrp_os_start
+ */
+void cx_stack_init(void) {
+    struct stack_class *sc;
+    u32 i;
+
+    for (i = 0; i < STACK_CLASSES; i++) {
+        sc = &stack_classes[i];
+        sc->sc_size = ARCH_MIN_STACK_SIZE << i;
+        sc->sc_head = 0;
+        sc->sc_count = 0;
+        sc->sc_mapped = 0;
+        sc->sc_reused = 0;
+        sc->sc_limit = STACK_CACHE_BYTES / sc->sc_size;
+        if (STACK_CACHE_MAX < sc->sc_limit)
+            sc->sc_limit = STACK_CACHE_MAX;
+        if (2 > sc->sc_limit)
+            sc->sc_limit = 2;
+    }
+
+    CX_CONSOLE_CREATE(g_console_fncs, g_console_fnclist);
+}
+
+/**
+ *      Allocate a stack.  Called with the kernel lock held.
+ *
+ * @ingroup cxgrp_kernel_only
+ *
+ * @param[in,out] size
+ *      Bytes wanted; set to the size of the stack returned
+ *
+ * @retval NULL
+ *      Too big, or the host is out of memory
+ * @return
+ *      Lowest address of the stack
+ */
+u8 *cx_stack_alloc(u32 * size) {
+    struct stack_class *sc;
+    u8 *stack;
+
+    sc = cx_stack_class(*size);
+    if (NULL == sc)
+        return (NULL);
+    *size = sc->sc_size;
+
+    if (0 != sc->sc_count) {
+        sc->sc_head = (sc->sc_head + STACK_CACHE_MAX - 1) % STACK_CACHE_MAX;
+        sc->sc_count--;
+        sc->sc_reused++;
+        return (sc->sc_cache[sc->sc_head]);
+    }
+
+    stack = (u8 *) arch_stack_map(sc->sc_size);
+    if (NULL != stack)
+        sc->sc_mapped++;
+    return (stack);
+}
+
+/**
+ *      Give back a stack from cx_stack_alloc().  Called with the
+ *      kernel lock held.
+ *
+ *      A thread ending itself is still running on its stack when
+ *      it frees it.  That is fine: the stack only goes into the
+ *      cache, and nobody can take it out before the thread has
+ *      switched away and let go of the lock.  Only stacks freed
+ *      earlier are ever unmapped here.
+ *
+ * @ingroup cxgrp_kernel_only
+ *
+ * @param[in] stack
+ *      Stack returned by cx_stack_alloc()
+ * @param[in] size
+ *      Its size as set by cx_stack_alloc()
+ */
+void cx_stack_free(u8 * stack, u32 size) {
+    struct stack_class *sc;
+    u32 oldest;
+
+    sc = cx_stack_class(size);
+    if (NULL == sc)
+        return;
+
+    if (sc->sc_limit == sc->sc_count) {
+        oldest = (sc->sc_head + STACK_CACHE_MAX - sc->sc_count) %
+            STACK_CACHE_MAX;
+        arch_stack_unmap(sc->sc_cache[oldest], sc->sc_size);
+        sc->sc_mapped--;
+        sc->sc_count--;
+    }
+
+    sc->sc_cache[sc->sc_head] = stack;
+    sc->sc_head = (sc->sc_head + 1) % STACK_CACHE_MAX;
+    sc->sc_count++;
+}
+
+/**
+ *      Fill the stack of a new thread with the pattern if stack
+ *      checking is on.  Called with the kernel lock held before the
+ *      context of the thread is set up.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+void cx_stack_fill(PCB_t * pcb) {
+    if (0 == stack_check)
+        return;
+
+    memset(pcb->th_cold->stack_info.stack, STACK_FILL,
+           pcb->th_cold->stack_info.stack_size);
+    pcb->th_attr |= TH_STACK_FILLED;
+}
+
+/**
+ *      Return the most bytes of its stack a thread has used, or 0
+ *      if its stack was not filled.  It may have used more: a
+ *      frame that skips over bytes it never writes is not seen.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+u32 cx_stack_used(PCB_t * pcb) {
+    u8 *stack = pcb->th_cold->stack_info.stack;
+    u32 size = pcb->th_cold->stack_info.stack_size;
+    u32 i;
+
+    if (TH_STACK_FILLED != (TH_STACK_FILLED & pcb->th_attr))
+        return (0);
+
+    for (i = 0; (i < size) && (STACK_FILL == stack[i]); i++);
+    return (size - i);
+}
+
+/**
+ *      Warn if the thread giving up the cpu has come within the
+ *      margin of the end of its stack.  Only the few bytes of the
+ *      pattern just above the margin are looked at, so this is cheap
+ *      enough to do on every switch.  Each thread is warned about
+ *      once.  Called with the kernel lock held for a thread whose
+ *      stack was filled.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+void cx_stack_check(PCB_t * pcb) {
+    u8 *probe;
+    u32 i;
+
+    if (pcb->th_cold->stack_info.stack_size < stack_margin + STACK_PROBE)
+        return;
+
+    probe = pcb->th_cold->stack_info.stack + stack_margin;
+    for (i = 0; i < STACK_PROBE; i++) {
+        if (STACK_FILL != probe[i])
+            break;
+    }
+    if (STACK_PROBE == i)
+        return;
+
+    pcb->th_attr |= TH_STACK_WARNED;
+    cx_llprintf("\n%d:WARNING:%s is within %u bytes of the end of its "
+                "%u byte stack\n\r", pcb->th_pid, pcb->th_cold->th_name,
+                stack_margin, pcb->th_cold->stack_info.stack_size);
+}
+
+/**
+ *      Turn filling the stacks of new threads on or off.  Threads
+ *      already running are not affected.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] on
+ *      Nonzero to fill the stacks of threads started from now on
+ */
+void cx_stack_check_set(u32 on) {
+    stack_check = on;
+}
+
+/**
+ *      Return nonzero if the stacks of new threads are filled
+ *
+ * @ingroup cxgrp_thread
+ */
+u32 cx_stack_check_get(void) {
+    return (stack_check);
+}
+
+/**
+ *      Set how close to the end of its stack a thread may come
+ *      before it is warned about.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] bytes
+ *      Bytes from the end of the stack
+ */
+void cx_stack_margin_set(u32 bytes) {
+    stack_margin = bytes;
+}
+
+/**
+ *      Return how close to the end of its stack a thread may come
+ *      before it is warned about
+ *
+ * @ingroup cxgrp_thread
+ */
+u32 cx_stack_margin_get(void) {
+    return (stack_margin);
+}
+
+/**
+ *      Return the most bytes of its stack a thread has used.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] pid
+ *      Process id of the thread
+ *
+ * @retval -1
+ *      Failure, errno is set to ESRCH if there is no such thread,
+ *      or ENOENT if its stack was not filled when it started
+ * @return
+ *      Bytes of stack used
+ */
+i32 cx_thread_stack_used(i32 pid) {
+    PCB_t *pcb;
+    i32 used;
+    unsigned long s;
+
+    pcb = cx_get_pcb(pid);
+    if (NULL == pcb) {
+        errno = ESRCH;
+        return (-1);
+    }
+
+    s = cx_intsoff();
+    if (CX_SCHED_IS_PCB_DEAD(pcb)) {
+        cx_intson(s);
+        errno = ESRCH;
+        return (-1);
+    }
+    if (TH_STACK_FILLED != (TH_STACK_FILLED & pcb->th_attr)) {
+        cx_intson(s);
+        errno = ENOENT;
+        return (-1);
+    }
+    used = (i32) cx_stack_used(pcb);
+    cx_intson(s);
+
+    return (used);
+}
+
+/************************************************************************************
+ * Private Functions
+ */
+
+/* ------------------------------------------------------------ */
+static struct stack_class *cx_stack_class(u32 size) {
+    u32 i;
+
+    for (i = 0; i < STACK_CLASSES; i++) {
+        if (size <= stack_classes[i].sc_size)
+            return (&stack_classes[i]);
+    }
+    return (NULL);
+}
+
+/* ------------------------------------------------------------ */
+static i32 do_stacks(i32 argc, char **argv) {
+    struct stack_class *sc;
+    u32 i;
+    unsigned long s;
+    u32 mapped[STACK_CLASSES], cached[STACK_CLASSES], reused[STACK_CLASSES];
+
+    if ((argc > 2) && (0 == strncmp(argv[1], "check", 6))) {
+        cx_stack_check_set(0 == strncmp(argv[2], "on", 3));
+    } else if ((argc > 2) && (0 == strncmp(argv[1], "margin", 7))) {
+        cx_stack_margin_set((u32) atoi(argv[2]));
+    } else if (argc > 1) {
+        printf("stacks [check on|off] [margin <bytes>]\n");
+        return (-1);
+    }
+
+    s = cx_intsoff();
+    for (i = 0; i < STACK_CLASSES; i++) {
+        sc = &stack_classes[i];
+        mapped[i] = sc->sc_mapped;
+        cached[i] = sc->sc_count;
+        reused[i] = sc->sc_reused;
+    }
+    cx_intson(s);
+
+    printf("SIZE MAPPED CACHED REUSED\n");
+    for (i = 0; i < STACK_CLASSES; i++) {
+        if (0 != mapped[i])
+            printf("%u %u %u %u\n", stack_classes[i].sc_size,
+                   mapped[i], cached[i], reused[i]);
+    }
+    if (0 == cx_stack_check_get())
+        printf("Checking off\n");
+    else
+        printf("Checking on, margin %u bytes\n", cx_stack_margin_get());
+    return (0);
+}
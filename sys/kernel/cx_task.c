@@ -0,0 +1,599 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * @file cx_task.c
+ *      Tasks
+ *
+ * A task is a function that is run in steps.  It has no stack and
+ * no context of its own: waiting for something returns from the
+ * function, after noting in the task where it stopped, and running
+ * it again calls the function, which jumps back to that point (see
+ * CX_TASK_BEGIN() in cx_task.h).  All it costs is the cx_task
+ * structure, and going from one task to the next is a return and a
+ * call.
+ *
+ * The tasks that are ready to run wait on one queue.  A single
+ * thread, the executor, takes them off in turn and runs each one
+ * step.  It is an ordinary thread to the scheduler, so tasks get the
+ * cpu time of one thread at the default level; after TASK_BATCH
+ * steps it yields so the other threads of its level have a turn.
+ * When no task is ready it suspends until one is made ready.  It is
+ * started with the first task.
+ *
+ * Tasks wait on semaphores next to the threads that wait on them,
+ * on mailboxes, for events, and for time to pass.  The tasks
+ * waiting for an event are kept on one queue, which cx_event_post()
+ * goes through after the threads; a tty posts TTY_EVENT_RX when
+ * input comes in, so a task can wait for input this way.  The
+ * tasks waiting for time are kept in order of their wake up time,
+ * with one kernel timer set for the first of them.
+ *
+ * A task runs on the executor's stack, so it must not block: no
+ * sem_wait() or cx_msleep(), only the CX_TASK_ waits.
+ */
+
+/************************************************************************************
+ * Includes
+ */
+#include <chrysalix.h>
+#include "arch_context.h"
+#include "cx_sched.h"
+#include "cx_timer.h"
+
+/************************************************************************************
+ * Defines
+ */
+    /** Steps the executor runs before it yields to other threads */
+#define TASK_BATCH              32
+
+    /** States of a task */
+#define TASK_IDLE               0
+#define TASK_READY              1
+#define TASK_RUNNING            2
+#define TASK_WAITING            3
+
+/************************************************************************************
+ * Prototypes
+ */
+static void cx_task_executor(i32 arg);
+static void cx_task_done(struct cx_task *task);
+static int cx_task_sleep_cmp(struct pqueue_node *a, struct pqueue_node *b);
+static void cx_task_timer_expired(void *arg);
+static i32 do_tasks(i32 argc, char **argv);
+
+/************************************************************************************
+ * Globals
+ */
+static struct queue task_ready;
+static struct queue task_events;
+static struct pqueue task_sleeping;
+static struct timer task_timer;
+
+    /** Pid of the executor, -1 until the first task starts */
+static i32 task_exec_pid = -1;
+
+    /** Nonzero while the executor is suspended for want of tasks */
+static u32 task_exec_waiting;
+
+static u32 task_started;
+static u32 task_finished;
+static u32 task_steps;
+
+static const struct console_fnc g_console_fncs[] = {
+    { "tasks", do_tasks }
+};
+
+static struct console_fnc_list g_console_fnclist;
+
+/************************************************************************************
+ * Functions
+ */
+
+/**
+ *      Set up the queues and register the console command
+ *
+ * @ingroup cxgrp_os_start
+ */
+void cx_task_init(void) {
+    queue_init(&task_ready);
+    queue_init(&task_events);
+    pqueue_init(&task_sleeping, cx_task_sleep_cmp);
+    cx_timer_setup(&task_timer, cx_task_timer_expired, NULL);
+
+    CX_CONSOLE_CREATE(g_console_fncs, g_console_fnclist);
+}
+
+/**
+ *      Start a task.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] task
+ *      Task structure, which must stay put until the task is done.
+ *      A task that is not done must not be started again.
+ * @param[in] fn
+ *      Task function.  It returns CX_TASK_PENDING from a wait and
+ *      CX_TASK_DONE when the task is done, as the CX_TASK_ macros
+ *      do.
+ * @param[in] arg
+ *      Kept in task->tk_arg for @p fn
+ *
+ * @retval -1
+ *      Failure, errno is set to EINVAL if @p task or @p fn is NULL,
+ *      or as by cx_thread_start() if the executor could not start
+ * @retval 0
+ *      The task is ready to run
+ */
+i32 cx_task_start(struct cx_task *task, i32 (*fn)(struct cx_task *task),
+                  void *arg) {
+    i32 pid;
+    i32 s;
+
+    if ((NULL == task) || (NULL == fn)) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    s = cx_intsoff();
+    if (0 > task_exec_pid) {
+        pid = cx_thread_start("tasks", NULL, ARCH_TASK_STACK_SIZE,
+                              cx_task_executor, 0);
+        if (0 > pid) {
+            cx_intson(s);
+            return (-1);
+        }
+
+        /* It runs the tasks of every group */
+        (void) cx_thread_setgroup(pid, 0);
+        task_exec_pid = pid;
+    }
+
+    task->tk_fn = fn;
+    task->tk_arg = arg;
+    task->tk_line = 0;
+    task->tk_granted = 0;
+    task->tk_event = 0;
+    task->tk_msg = NULL;
+    queue_init(&task->tk_joiners);
+    task_started++;
+    cx_task_ready(task);
+    cx_intson(s);
+
+    return (0);
+}
+
+/**
+ *      Wait for a task to be done.  Called by a thread, never by a
+ *      task.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] task
+ *      Task started with cx_task_start()
+ *
+ * @retval -1
+ *      Failure, errno is set to EINVAL if @p task is NULL, or
+ *      EDEADLK if called from a task
+ * @retval 0
+ *      The task is done
+ */
+i32 cx_task_join(struct cx_task *task) {
+    PCB_t *self;
+    u32 runs;
+    i32 s;
+
+    if (NULL == task) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    s = cx_intsoff();
+    if (cx_getpid() == task_exec_pid) {
+        cx_intson(s);
+        errno = EDEADLK;
+        return (-1);
+    }
+
+    /*
+     * The task takes us off its queue when it is done, so being
+     * woken by a signal before that means going back to sleep
+     */
+    if (TASK_IDLE != task->tk_state) {
+        self = cx_get_current_pcb();
+        runs = task->tk_runs;
+        enqueue(&task->tk_joiners, &self->sem_link);
+        while (runs == task->tk_runs) {
+            cx_thread_set_state_pcb(self, TH_JOINING);
+            (void) cx_yield();
+        }
+    }
+    cx_intson(s);
+
+    return (0);
+}
+
+/**
+ *      Put a task on the queue of tasks ready to run, waking up the
+ *      executor if it is waiting for one.
+ *
+ * @ingroup cxgrp_thread
+ */
+void cx_task_ready(struct cx_task *task) {
+    i32 s;
+
+    s = cx_intsoff();
+    task->tk_state = TASK_READY;
+    enqueue(&task_ready, &task->tk_link);
+    if (task_exec_waiting) {
+        task_exec_waiting = 0;
+        (void) cx_thread_set_state(task_exec_pid, TH_RUNNING);
+    }
+    cx_intson(s);
+}
+
+/**
+ *      Have a task made ready in @p msecs.  Used by CX_TASK_SLEEP().
+ *
+ * @ingroup cxgrp_thread
+ */
+void cx_task_sleep(struct cx_task *task, u32 msecs) {
+    i32 s;
+
+    s = cx_intsoff();
+    task->tk_state = TASK_WAITING;
+    task->tk_wake = arch_get_mtime() + msecs;
+    pqueue_insert(&task_sleeping, &task->tk_sleep_node);
+    if (&task->tk_sleep_node == pqueue_first(&task_sleeping))
+        cx_timer_add(&task_timer, task->tk_wake);
+    cx_intson(s);
+}
+
+/**
+ *      Take the semaphore @p sem for a task, or have the task wait
+ *      for it.  Used by CX_TASK_AWAIT_SEM(), which calls it again
+ *      when the task has been handed the semaphore.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @retval -1
+ *      The task is waiting
+ * @retval 0
+ *      The task has the semaphore
+ */
+i32 cx_task_sem_wait(struct cx_task *task, struct semaphore *sem) {
+    i32 s;
+
+    if (task->tk_granted) {
+        task->tk_granted = 0;
+        return (0);
+    }
+
+    s = cx_intsoff();
+    if (0 <= --sem->value) {
+        cx_intson(s);
+        return (0);
+    }
+    task->tk_state = TASK_WAITING;
+    enqueue(&sem->sem_tasks, &task->tk_link);
+    cx_intson(s);
+
+    return (-1);
+}
+
+/**
+ *      Hand a task what it was waiting for, a semaphore or a
+ *      message, and make it ready.  Called with the kernel lock
+ *      held.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+void cx_task_grant(struct cx_task *task) {
+    task->tk_granted = 1;
+    cx_task_ready(task);
+}
+
+/**
+ *      Take a message out of @p mbox for a task, or have the task
+ *      wait for one.  Used by CX_TASK_AWAIT_MSG(), which calls it
+ *      again when a message has been copied into @p msg.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[out] msg
+ *      Where the message is copied to.  It must outlive the wait,
+ *      so it cannot be a local of the task function.
+ *
+ * @retval -1
+ *      The task is waiting
+ * @retval 0
+ *      The message is in @p msg
+ */
+i32 cx_task_msg_recv(struct cx_task *task, struct cx_mbox *mbox,
+                     struct msg *msg) {
+    i32 s;
+
+    if (task->tk_granted) {
+        task->tk_granted = 0;
+        return (0);
+    }
+
+    s = cx_intsoff();
+    if (0 != mbox->mb_count) {
+        memcpy(msg, &mbox->mb_msgs[mbox->mb_head], sizeof(struct msg));
+        mbox->mb_head = (mbox->mb_head + 1) % CX_MBOX_SIZE;
+        mbox->mb_count--;
+        cx_intson(s);
+        return (0);
+    }
+    task->tk_state = TASK_WAITING;
+    task->tk_msg = msg;
+    enqueue(&mbox->mb_tasks, &task->tk_link);
+    cx_intson(s);
+
+    return (-1);
+}
+
+/**
+ *      Have a task wait for the next cx_event_post() of @p val.  Used
+ *      by CX_TASK_AWAIT_EVENT(), which calls it again when the event
+ *      has been posted.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @retval -1
+ *      The task is waiting
+ * @retval 0
+ *      The event was posted
+ *
+ * @note
+ *      As for threads, an event posted while no task waits for it
+ *      is not kept.  A tty posts TTY_EVENT_RX only when the system
+ *      goes idle, so a task reading one should read what is there
+ *      before it waits.
+ */
+i32 cx_task_event_wait(struct cx_task *task, u32 val) {
+    i32 s;
+
+    if (task->tk_granted) {
+        task->tk_granted = 0;
+        return (0);
+    }
+
+    s = cx_intsoff();
+    task->tk_state = TASK_WAITING;
+    task->tk_event = val;
+    enqueue(&task_events, &task->tk_link);
+    cx_intson(s);
+
+    return (-1);
+}
+
+/**
+ *      Make the tasks waiting for the event @p val ready.  Called by
+ *      cx_event_post() with the kernel lock held.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+void cx_task_event_post(u32 val) {
+    struct cx_task *task;
+    struct queue *q;
+    struct queue *next;
+
+    for (q = queue_first(&task_events); q != &task_events; q = next) {
+        next = queue_next(q);
+        task = queue_entry(q, struct cx_task, tk_link);
+        if (task->tk_event != val)
+            continue;
+        queue_remove(q);
+        cx_task_grant(task);
+    }
+}
+
+/**
+ *      Set up an empty mailbox.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @retval -1
+ *      Failure, errno is set to EINVAL if @p mbox is NULL
+ * @retval 0
+ *      Success
+ */
+i32 cx_mbox_init(struct cx_mbox *mbox) {
+    if (NULL == mbox) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    mbox->mb_head = 0;
+    mbox->mb_count = 0;
+    queue_init(&mbox->mb_tasks);
+
+    return (0);
+}
+
+/**
+ *      Post a message to a mailbox.  It goes straight to the first
+ *      task waiting on the mailbox, if there is one.  Threads and
+ *      tasks may post.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] mbox
+ *      Mailbox
+ * @param[in] msg
+ *      Message, copied.  Its source is set to the caller's pid.
+ *
+ * @retval -1
+ *      Failure, errno is set to EINVAL if an argument is NULL, or
+ *      EAGAIN if the mailbox is full
+ * @retval 0
+ *      Success
+ */
+i32 cx_mbox_post(struct cx_mbox *mbox, struct msg *msg) {
+    struct cx_task *task;
+    struct queue *q;
+    i32 s;
+
+    if ((NULL == mbox) || (NULL == msg)) {
+        errno = EINVAL;
+        return (-1);
+    }
+    msg->msg_source = cx_getpid();
+
+    s = cx_intsoff();
+    q = dequeue(&mbox->mb_tasks);
+    if (NULL != q) {
+        task = queue_entry(q, struct cx_task, tk_link);
+        memcpy(task->tk_msg, msg, sizeof(struct msg));
+        task->tk_msg = NULL;
+        cx_task_grant(task);
+    } else if (CX_MBOX_SIZE == mbox->mb_count) {
+        cx_intson(s);
+        errno = EAGAIN;
+        return (-1);
+    } else {
+        memcpy(&mbox->mb_msgs[(mbox->mb_head + mbox->mb_count) %
+                              CX_MBOX_SIZE], msg, sizeof(struct msg));
+        mbox->mb_count++;
+    }
+    cx_intson(s);
+
+    return (0);
+}
+
+/************************************************************************************
+ * Private Functions
+ */
+
+/*
+ * Run the tasks that are ready, one step each, in the order they
+ * became ready.  The lock is let go while a task runs.
+ */
+static void cx_task_executor(i32 arg _UNUSED_) {
+    struct cx_task *task;
+    struct queue *q;
+    u32 batch = 0;
+    i32 ret;
+    i32 s;
+
+    s = cx_intsoff();
+    while (1) {
+        q = dequeue(&task_ready);
+        if (NULL == q) {
+            task_exec_waiting = 1;
+            cx_thread_set_state_pcb(cx_get_current_pcb(), TH_SUSPENDED);
+            (void) cx_yield();
+            batch = 0;
+            continue;
+        }
+
+        task = queue_entry(q, struct cx_task, tk_link);
+        task->tk_state = TASK_RUNNING;
+        task_steps++;
+        cx_intson(s);
+
+        ret = task->tk_fn(task);
+
+        s = cx_intsoff();
+        if (CX_TASK_PENDING != ret)
+            cx_task_done(task);
+        if (TASK_BATCH == ++batch) {
+            batch = 0;
+            (void) cx_yield();
+        }
+    }
+}
+
+/*
+ * Wake up the threads waiting for the task.  Called with the lock
+ * held.
+ */
+static void cx_task_done(struct cx_task *task) {
+    struct queue *q;
+
+    task->tk_state = TASK_IDLE;
+    task->tk_runs++;
+    task_finished++;
+    while (NULL != (q = dequeue(&task->tk_joiners)))
+        cx_thread_set_state_pcb(queue_entry(q, PCB_t, sem_link), TH_RUNNING);
+}
+
+/*
+ * Earliest wake up time first
+ */
+static int cx_task_sleep_cmp(struct pqueue_node *a, struct pqueue_node *b) {
+    struct cx_task *ta = pqueue_entry(a, struct cx_task, tk_sleep_node);
+    struct cx_task *tb = pqueue_entry(b, struct cx_task, tk_sleep_node);
+
+    if (ta->tk_wake < tb->tk_wake)
+        return (-1);
+    return (ta->tk_wake > tb->tk_wake);
+}
+
+/*
+ * Make the tasks whose time has come ready, and set the timer for
+ * the next one
+ */
+static void cx_task_timer_expired(void *arg _UNUSED_) {
+    struct cx_task *task;
+    u64 now;
+
+    now = arch_get_mtime();
+    while (!pqueue_empty(&task_sleeping)) {
+        task = pqueue_entry(pqueue_first(&task_sleeping), struct cx_task,
+                            tk_sleep_node);
+        if (task->tk_wake > now) {
+            cx_timer_add(&task_timer, task->tk_wake);
+            break;
+        }
+        (void) pqueue_remove_first(&task_sleeping);
+        cx_task_ready(task);
+    }
+}
+
+static i32 do_tasks(i32 argc _UNUSED_, char **argv _UNUSED_) {
+    struct queue *q;
+    u32 ready = 0;
+    i32 s;
+
+    s = cx_intsoff();
+    for (q = queue_first(&task_ready); q != &task_ready; q = queue_next(q))
+        ready++;
+    cx_intson(s);
+
+    printf("EXEC STARTED DONE STEPS READY\n");
+    if (0 > task_exec_pid)
+        printf("- ");
+    else
+        printf("%d ", task_exec_pid);
+    printf("%u %u %u %u\n", task_started, task_finished, task_steps, ready);
+    return (0);
+}
@@ -0,0 +1,174 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * @file cx_timer.c
+ *      Kernel timers ordered by deadline
+ */
+
+/************************************************************************************
+ * Includes
+ */
+#include <chrysalix.h>
+#include "cx_timer.h"
+
+/************************************************************************************
+ * Prototypes
+ */
+static int cx_timer_cmp(struct pqueue_node *a, struct pqueue_node *b);
+
+/************************************************************************************
+ * Globals
+ */
+    /** Pending timers, earliest deadline first */
+static struct pqueue timerq;
+
+/************************************************************************************
+ * Functions
+ */
+
+/**
+ *      Initialize the timer queue
+ */
+void cx_timer_init(void) {
+    pqueue_init(&timerq, cx_timer_cmp);
+}
+
+/**
+ *      Set the function called when the timer expires.  Must be
+ *      called before the timer is used.
+ *
+ * @param[in] tm
+ *      Timer
+ * @param[in] func
+ *      Function to call on expiration
+ * @param[in] arg
+ *      Argument passed to @p func
+ */
+void cx_timer_setup(struct timer *tm, void (*func)(void *arg), void *arg) {
+    tm->tm_func = func;
+    tm->tm_arg = arg;
+    tm->tm_active = 0;
+}
+
+/**
+ *      Arm the timer to expire at time @p expire.  A timer which
+ *      is already armed is moved to its new deadline.
+ *
+ * @param[in] tm
+ *      Timer
+ * @param[in] expire
+ *      Time in msecs, as returned by arch_get_mtime()
+ */
+void cx_timer_add(struct timer *tm, u64 expire) {
+    if (CX_TIMER_IS_ACTIVE(tm))
+        pqueue_remove(&timerq, &tm->tm_link);
+
+    tm->tm_expire = expire;
+    tm->tm_active = 1;
+    pqueue_insert(&timerq, &tm->tm_link);
+}
+
+/**
+ *      Disarm the timer.  Nothing happens if it was not armed.
+ *
+ * @param[in] tm
+ *      Timer
+ */
+void cx_timer_cancel(struct timer *tm) {
+    if (CX_TIMER_IS_ACTIVE(tm)) {
+        pqueue_remove(&timerq, &tm->tm_link);
+        tm->tm_active = 0;
+    }
+}
+
+/**
+ *      Call the functions of all the timers which have
+ *      expired by @p now.
+ *
+ * @param[in] now
+ *      Current time in msecs
+ *
+ * @note
+ *      Only the timers which are due are looked at, so the cost
+ *      does not depend on the number of timers pending.
+ */
+void cx_timer_expire(u64 now) {
+    struct pqueue_node *node;
+    struct timer *tm;
+
+    while (!pqueue_empty(&timerq)) {
+        node = pqueue_first(&timerq);
+        tm = pqueue_entry(node, struct timer, tm_link);
+        if (tm->tm_expire > now)
+            break;
+
+        (void) pqueue_remove_first(&timerq);
+        tm->tm_active = 0;
+        tm->tm_func(tm->tm_arg);
+    }
+}
+
+/**
+ *      Get the earliest deadline of all the timers armed.
+ *
+ * @param[out] expire
+ *      Earliest deadline in msecs
+ *
+ * @retval 0
+ *      @p expire has been set
+ * @retval -1
+ *      No timers are armed
+ */
+i32 cx_timer_next(u64 * expire) {
+    struct timer *tm;
+
+    if (pqueue_empty(&timerq))
+        return (-1);
+
+    tm = pqueue_entry(pqueue_first(&timerq), struct timer, tm_link);
+    *expire = tm->tm_expire;
+    return (0);
+}
+
+/************************************************************************************
+ * Private Functions
+ */
+
+/* ------------------------------------------------------------ */
+static int cx_timer_cmp(struct pqueue_node *a, struct pqueue_node *b) {
+    struct timer *ta;
+    struct timer *tb;
+
+    ta = pqueue_entry(a, struct timer, tm_link);
+    tb = pqueue_entry(b, struct timer, tm_link);
+    if (ta->tm_expire < tb->tm_expire)
+        return (-1);
+    return (ta->tm_expire > tb->tm_expire) ? 1 : 0;
+}
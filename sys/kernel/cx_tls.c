@@ -0,0 +1,246 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * @file cx_tls.c
+ *      Thread-local storage
+ *
+ * A key names one pointer that every thread has its own copy of.
+ * The copies live in a small array in the PCB, so getting or
+ * setting one is an index into the running thread's PCB and needs
+ * no lock.  Every thread's copy of a new key starts out NULL.
+ *
+ * A key may have a destructor.  When a thread ends itself, by
+ * returning from its function, calling cx_thread_exit() or ending
+ * its own pid, the destructor of each key it holds a value for is
+ * called with that value.  A thread ended by another thread does
+ * not get to run them.
+ */
+
+/************************************************************************************
+ * Includes
+ */
+#include <chrysalix.h>
+#include "arch_context.h"
+#include "cx_sched.h"
+
+/************************************************************************************
+ * Defines
+ */
+    /**
+     * Times the destructors are run over when a thread ends, in
+     * case a destructor sets a value again
+     */
+#define TLS_DESTRUCTOR_PASSES   4
+
+/************************************************************************************
+ * Structures
+ */
+struct tls_key
+{
+    u32                     k_inuse;
+    void                    (*k_destructor)(void *value);
+};
+
+/************************************************************************************
+ * Globals
+ */
+static struct tls_key tls_keys[ARCH_MAX_TLS_KEYS];
+
+/************************************************************************************
+ * Functions
+ */
+
+/**
+ *      Make a new thread-local storage key.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] destructor
+ *      Called with the value of a thread that ends itself holding
+ *      one, or NULL
+ *
+ * @retval -1
+ *      Failure, errno is set to ENOSPC if all ARCH_MAX_TLS_KEYS
+ *      keys are in use
+ * @return
+ *      The key
+ */
+i32 cx_tls_key_create(void (*destructor)(void *value)) {
+    i32 key;
+    i32 s;
+
+    s = cx_intsoff();
+    for (key = 0; key < ARCH_MAX_TLS_KEYS; key++) {
+        if (!tls_keys[key].k_inuse)
+            break;
+    }
+    if (ARCH_MAX_TLS_KEYS == key) {
+        cx_intson(s);
+        errno = ENOSPC;
+        return (-1);
+    }
+
+    /*
+     * The threads may hold values left from the last key here
+     */
+    cx_tls_clear(key);
+    tls_keys[key].k_inuse = 1;
+    tls_keys[key].k_destructor = destructor;
+    cx_intson(s);
+
+    return (key);
+}
+
+/**
+ *      Give back a thread-local storage key.  The destructor is not
+ *      called for the values threads still hold.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] key
+ *      Key from cx_tls_key_create()
+ *
+ * @retval 0
+ *      Success
+ * @retval -1
+ *      Failure, errno is set to EINVAL if @p key is not in use
+ */
+i32 cx_tls_key_delete(i32 key) {
+    i32 s;
+
+    s = cx_intsoff();
+    if ((0 > key) || (ARCH_MAX_TLS_KEYS <= key) || (!tls_keys[key].k_inuse)) {
+        cx_intson(s);
+        errno = EINVAL;
+        return (-1);
+    }
+
+    tls_keys[key].k_inuse = 0;
+    tls_keys[key].k_destructor = NULL;
+    cx_intson(s);
+
+    return (0);
+}
+
+/**
+ *      Set the running thread's value of a key.
+ *
+ * @ingroup cxgrp_thread
+ *
+ * @param[in] key
+ *      Key from cx_tls_key_create()
+ * @param[in] value
+ *      New value
+ *
+ * @retval 0
+ *      Success
+ * @retval -1
+ *      Failure, errno is set to EINVAL if @p key is not in use or
+ *      this is not called from a thread, or from a fiber
+ */
+i32 cx_tls_set(i32 key, void *value) {
+    PCB_t *pcb = cx_get_current_pcb();
+
+    if ((0 > key) || (ARCH_MAX_TLS_KEYS <= key) ||
+        (!tls_keys[key].k_inuse) || (NULL == pcb) ||
+        (CX_SCHED_IS_FIBER(pcb))) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    pcb->th_cold->th_tls[key] = value;
+    return (0);
+}
+
+/**
+ *      Return the running thread's value of a key, NULL if it has
+ *      not set one, the key is not in use or it is a fiber
+ *
+ * @ingroup cxgrp_thread
+ */
+void *cx_tls_get(i32 key) {
+    PCB_t *pcb = cx_get_current_pcb();
+
+    if ((0 > key) || (ARCH_MAX_TLS_KEYS <= key) || (NULL == pcb) ||
+        (CX_SCHED_IS_FIBER(pcb)))
+        return (NULL);
+
+    return (pcb->th_cold->th_tls[key]);
+}
+
+/**
+ *      Call the destructors for the values a thread ending itself
+ *      holds.  Each value is cleared before its destructor is
+ *      called.  Called by the thread with the kernel lock held.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+void cx_tls_exit(PCB_t * pcb) {
+    void (*destructor)(void *value);
+    void *value;
+    u32 pass;
+    u32 called;
+    i32 key;
+
+    for (pass = 0; pass < TLS_DESTRUCTOR_PASSES; pass++) {
+        called = 0;
+        for (key = 0; key < ARCH_MAX_TLS_KEYS; key++) {
+            value = pcb->th_cold->th_tls[key];
+            destructor = tls_keys[key].k_destructor;
+            pcb->th_cold->th_tls[key] = NULL;
+            if ((NULL != value) && (NULL != destructor)) {
+                destructor(value);
+                called++;
+            }
+        }
+        if (0 == called)
+            break;
+    }
+}
+
+/**
+ *      Clear the value of a key in every live thread.  Dead ones
+ *      are cleared when they are started again.  Called with the
+ *      kernel lock held.
+ *
+ * @ingroup cxgrp_kernel_only
+ */
+void cx_tls_clear(i32 key) {
+    PCB_t *pcb;
+    u32 pid;
+
+    for (pid = 0; pid < cx_sched_npids(); pid++) {
+        if (CX_SCHED_IS_PID_DEAD(pid))
+            continue;
+        pcb = cx_get_pcb((i32) pid);
+        if (!CX_SCHED_IS_FIBER(pcb))
+            pcb->th_cold->th_tls[key] = NULL;
+    }
+}
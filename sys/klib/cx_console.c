@@ -240,8 +240,7 @@ void console_thread_start(i32 uistream) {
      * Wait for input
      */
     while (1) {
-        cx_yield();
-        retval = cx_readtm((fd_t) uistream, (void *) buf, bufsize, 0);
+        retval = cx_readtm((fd_t) uistream, (void *) buf, bufsize, -1);
         if ('\n' == buf[retval - 1]) {
             /*
              * Take out the the new line
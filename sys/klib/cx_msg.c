@@ -64,6 +64,7 @@ i32 cx_msg_init(void) {
 
 i32 cx_msg_send(ND_t nd, struct msg *msg, _UNUSED_ u32 flags, _UNUSED_ i32 tm) {
     PCB_t *srv_pcb;
+    i32 s;
 
     /*
      * Check if the message is to ourselves
@@ -80,31 +81,36 @@ i32 cx_msg_send(ND_t nd, struct msg *msg, _UNUSED_ u32 flags, _UNUSED_ i32 tm) {
         return (-ESRCH);
 
     /*
-     * Check if destination is alive
+     * Check if destination is alive, and a thread with a port
      */
     if (CX_SCHED_IS_PCB_DEAD(srv_pcb))
         return (-EHOSTDOWN);
+    if (CX_SCHED_IS_FIBER(srv_pcb))
+        return (-EINVAL);
 
     /*
-     * Take semaphore
+     * Take semaphore.  Hold the kernel lock until we are waiting
+     * for the reply, or the server could reply first.
      */
-    sem_wait(&srv_pcb->th_port.sem_send);
+    s = cx_intsoff();
+    sem_wait(&srv_pcb->th_cold->th_port.sem_send);
 
     /*
      * Place msg pointer in server's PCB
      */
-    srv_pcb->th_port.sent_msg = msg;
+    srv_pcb->th_cold->th_port.sent_msg = msg;
 
     /*
      * Wake up server
      */
-    sem_post(&srv_pcb->th_port.sem_recv);
+    sem_post(&srv_pcb->th_cold->th_port.sem_recv);
 
     /*
      * Wait for response
      */
     cx_thread_set_state_pcb(cx_get_current_pcb(), TH_MSG_REPLY);
     cx_yield();
+    cx_intson(s);
 
     /*
      * Return to client
@@ -119,16 +125,18 @@ i32 cx_msg_recv(_UNUSED_ ND_t nd, struct msg *msg, _UNUSED_ u32 flags, _UNUSED_
      * Get current pcb
      */
     current_pcb = cx_get_current_pcb();
+    if (CX_SCHED_IS_FIBER(current_pcb))
+        return (-EINVAL);
 
     /*
      * Wait for a message
      */
-    sem_wait(&current_pcb->th_port.sem_recv);
+    sem_wait(&current_pcb->th_cold->th_port.sem_recv);
 
     /*
      * Message available, give to the server
      */
-    memcpy((void *) msg, (void *) current_pcb->th_port.sent_msg,
+    memcpy((void *) msg, (void *) current_pcb->th_cold->th_port.sent_msg,
            sizeof(struct msg));
 
     /*
@@ -156,7 +164,7 @@ i32 cx_msg_reply(_UNUSED_ ND_t nd, struct msg *msg, _UNUSED_ u32 flags, _UNUSED_
     /*
      * Update the send semaphore so others can place messages there
      */
-    sem_post(&current_pcb->th_port.sem_send);
+    sem_post(&current_pcb->th_cold->th_port.sem_send);
 
     /*
      * Yield here to cooperate with other servers
@@ -75,10 +75,16 @@ void cx_fprintf(fd_t stream, const char *fmt, ...) {
 
 void cx_vfprintf(fd_t stream, const char *fmt, va_list args) {
     i32 retval;
+    i32 s;
 
+    /*
+     * cx_print_buf is shared by everyone
+     */
+    s = cx_intsoff();
     retval = cx_vsprintf(cx_print_buf, fmt, args);
     if (0 < retval)
         cx_writetm(stream, cx_print_buf, retval, -1);
+    cx_intson(s);
 }
 
 /*-
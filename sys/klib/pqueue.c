@@ -0,0 +1,167 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * pqueue.c - intrusive priority queue library
+ *
+ * Pairing heap.  Insert is O(1), removing the first or any other
+ * element is O(log n) amortized.  Elements are embedded in the
+ * structures they order, so the queue never allocates memory.
+ */
+
+#include <chrysalix/pqueue.h>
+
+#define PQ_NULL		((struct pqueue_node *) 0)
+
+/*
+ * Join two heaps, returning the new root
+ */
+static struct pqueue_node *pqueue_meld(struct pqueue *pq,
+                                       struct pqueue_node *a,
+                                       struct pqueue_node *b) {
+    struct pqueue_node *tmp;
+
+    if (a == PQ_NULL)
+        return b;
+    if (b == PQ_NULL)
+        return a;
+
+    if (pq->cmp(b, a) < 0) {
+        tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    /*
+     * b becomes the first child of a
+     */
+    b->prev = a;
+    b->next = a->child;
+    if (a->child != PQ_NULL)
+        a->child->prev = b;
+    a->child = b;
+    return a;
+}
+
+/*
+ * Merge a list of siblings into one heap using the two pass
+ * method, returning the new root
+ */
+static struct pqueue_node *pqueue_combine(struct pqueue *pq,
+                                          struct pqueue_node *first) {
+    struct pqueue_node *a, *b, *pairs, *next, *root;
+
+    /*
+     * First pass: meld pairs from left to right.  The results
+     * are kept on a stack linked through next.
+     */
+    pairs = PQ_NULL;
+    while (first != PQ_NULL) {
+        a = first;
+        b = a->next;
+        first = (b != PQ_NULL) ? b->next : PQ_NULL;
+
+        a->next = a->prev = PQ_NULL;
+        if (b != PQ_NULL) {
+            b->next = b->prev = PQ_NULL;
+            a = pqueue_meld(pq, a, b);
+        }
+        a->next = pairs;
+        pairs = a;
+    }
+
+    /*
+     * Second pass: meld the pairs from right to left
+     */
+    root = PQ_NULL;
+    while (pairs != PQ_NULL) {
+        next = pairs->next;
+        pairs->next = PQ_NULL;
+        root = pqueue_meld(pq, root, pairs);
+        pairs = next;
+    }
+    return root;
+}
+
+/*
+ * Initialize an empty queue ordered by cmp
+ */
+void pqueue_init(struct pqueue *pq,
+                 int (*cmp)(struct pqueue_node *a, struct pqueue_node *b)) {
+    pq->root = PQ_NULL;
+    pq->cmp = cmp;
+}
+
+/*
+ * Insert element in queue
+ */
+void pqueue_insert(struct pqueue *pq, struct pqueue_node *node) {
+    node->child = node->next = node->prev = PQ_NULL;
+    pq->root = pqueue_meld(pq, pq->root, node);
+}
+
+/*
+ * Remove and return the first element of the queue
+ */
+struct pqueue_node *pqueue_remove_first(struct pqueue *pq) {
+    struct pqueue_node *node;
+
+    node = pq->root;
+    if (node != PQ_NULL)
+        pqueue_remove(pq, node);
+    return node;
+}
+
+/*
+ * Remove specified element from queue
+ */
+void pqueue_remove(struct pqueue *pq, struct pqueue_node *node) {
+    struct pqueue_node *sub;
+
+    if (node == pq->root) {
+        pq->root = pqueue_combine(pq, node->child);
+    } else {
+        /*
+         * Take it out of its parent's list of children
+         */
+        if (node->prev->child == node)
+            node->prev->child = node->next;
+        else
+            node->prev->next = node->next;
+        if (node->next != PQ_NULL)
+            node->next->prev = node->prev;
+
+        sub = pqueue_combine(pq, node->child);
+        pq->root = pqueue_meld(pq, pq->root, sub);
+    }
+
+    if (pq->root != PQ_NULL)
+        pq->root->prev = PQ_NULL;
+    node->child = node->next = node->prev = PQ_NULL;
+}
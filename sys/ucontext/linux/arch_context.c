@@ -30,6 +30,9 @@
  * SUCH DAMAGE.
  */
 
+    /* For the names of the registers saved in a ucontext_t */
+#define _GNU_SOURCE
+
 #ifndef NULL
 #define NULL 0
 #endif
@@ -57,9 +60,11 @@
      */
 #include <cx_arch.h>
 #include <chrysalix/queue.h>
+#include <chrysalix/pqueue.h>
 #include <chrysalix/list.h>
 #include <chrysalix/cx_err.h>
 #include <chrysalix/cx.h>
+#include <chrysalix/cx_isr.h>
 #include <chrysalix/cx_utils.h>
 #include <chrysalix/cx_msg.h>
 #include <chrysalix/cx_io.h>
@@ -79,26 +84,39 @@
  * Globals
  */
 #define SCHEDSTKSZ  (30*1024)
-static u8 sched_stack[SCHEDSTKSZ];
-static struct context blah;
+static u8 sched_stack[ARCH_NCPUS][SCHEDSTKSZ];
+static struct context blah[ARCH_NCPUS];
 
 /* ------------------------------------------------------------ */
 static void linux_entry_point(void) {
     PCB_t *pcb;
 
+    cx_cpu_enter();
     linux_entry_point_setup();
 
     pcb = cx_get_current_pcb();
     if (NULL == pcb) {
         pcb = cx_get_sched_pcb();
     }
-    pcb->entry_info.fnc(pcb->entry_info.arg);
-    cx_thread_end(cx_getpid());
+    pcb->th_cold->entry_info.fnc(pcb->th_cold->entry_info.arg);
 
+    /*
+     * Keep the kernel lock until we are off this stack.  Switch
+     * to the next thread directly; the dead thread is never
+     * resumed, so uc_link is not used.
+     */
+    (void) cx_intsoff();
+    cx_thread_end(cx_getpid());
+    arch_yield();
 }
 
 /* ------------------------------------------------------------ */
 static void sched_schedule_thread(_UNUSED_ i32 arg) {
+    /*
+     * The scheduler context only lets go of the kernel lock
+     * while it idles
+     */
+    (void) cx_intsoff();
     while (1) {
         cx_sched_schedule();
     }
@@ -108,7 +126,10 @@ static void sched_schedule_thread(_UNUSED_ i32 arg) {
  * Initialize architecture context library
  */
 void arch_context_init(void) {
-    getcontext(&blah.uctx);
+    u32 i;
+
+    for (i = 0; i < ARCH_NCPUS; i++)
+        getcontext(&blah[i].uctx);
 }
 
 /*
@@ -126,18 +147,18 @@ void arch_context_set(PCB_t * pcb) {
     ucontext_t *uc;
 
     sched_pcb = cx_get_sched_pcb();
-    ctx = &pcb->ctx;
+    ctx = CX_SCHED_CTX(pcb);
     uc = &ctx->uctx;
 
     getcontext(uc);
-    uc->uc_stack.ss_sp = (void *) pcb->stack_info.stack;
-    uc->uc_stack.ss_size = (size_t) pcb->stack_info.stack_size;
+    uc->uc_stack.ss_sp = (void *) pcb->th_cold->stack_info.stack;
+    uc->uc_stack.ss_size = (size_t) pcb->th_cold->stack_info.stack_size;
     uc->uc_stack.ss_flags = 0;
 
     if (pcb != sched_pcb) {
-        uc->uc_link = &sched_pcb->ctx.uctx;
+        uc->uc_link = &sched_pcb->th_cold->ctx.uctx;
     } else {
-        uc->uc_link = &blah.uctx;
+        uc->uc_link = &blah[0].uctx;
     }
     makecontext(uc, linux_entry_point, 1, linux_entry_point);
 }
@@ -151,16 +172,17 @@ void arch_context_switch(struct context *prev, struct context *next) {
 }
 
 void arch_context_switch_start(void) {
-    arch_context_switch(&blah, &(cx_get_sched_pcb())->ctx);
+    arch_context_switch(&blah[arch_cpu_id()],
+                        &(cx_get_sched_pcb())->th_cold->ctx);
 }
 
-void arch_context_create_sched(PCB_t * sched_pcb) {
-    strncpy(sched_pcb->th_name, "sched", ARCH_MAX_THREAD_NAME);
+void arch_context_create_sched(PCB_t * sched_pcb, u32 cpu) {
+    strncpy(sched_pcb->th_cold->th_name, "sched", ARCH_MAX_THREAD_NAME);
     sched_pcb->th_state = TH_RUNNING;
-    sched_pcb->stack_info.stack = sched_stack;
-    sched_pcb->stack_info.stack_size = SCHEDSTKSZ;
-    sched_pcb->entry_info.fnc = sched_schedule_thread;
-    sched_pcb->entry_info.arg = 0;
+    sched_pcb->th_cold->stack_info.stack = sched_stack[cpu];
+    sched_pcb->th_cold->stack_info.stack_size = SCHEDSTKSZ;
+    sched_pcb->th_cold->entry_info.fnc = sched_schedule_thread;
+    sched_pcb->th_cold->entry_info.arg = 0;
     arch_context_set(sched_pcb);
 }
 
@@ -192,22 +214,21 @@ void arch_context_restore(_UNUSED_ struct context *ctx, _UNUSED_ void *regs) {
 
 }
 
-void arch_context_print(_UNUSED_ struct context *ctx) {
-    printf("LinuxUcontextStuffHere\n");
-}
-
-/**
- * Yield !
+/*
+ * Stack pointer a switched out context was saved at.  swapcontext()
+ * keeps the registers in the ucontext, so nothing below it is in
+ * use.  Where it is not known, the whole stack is.
  */
-void arch_yield(void) {
-    PCB_t *sched, *pcb;
-
-    pcb = cx_get_current_pcb();
-    sched = cx_get_sched_pcb();
-    arch_context_switch(&pcb->ctx, &sched->ctx);
-
+void *arch_context_sp(struct context *ctx) {
+#if defined(__x86_64__)
+    return ((void *) ctx->uctx.uc_mcontext.gregs[REG_RSP]);
+#elif defined(__aarch64__)
+    return ((void *) ctx->uctx.uc_mcontext.sp);
+#else
+    return (NULL);
+#endif
 }
 
-u64 arch_get_mtime(void) {
-    return (linux_get_mtime());
+void arch_context_print(_UNUSED_ struct context *ctx) {
+    printf("LinuxUcontextStuffHere\n");
 }
@@ -36,6 +36,8 @@
  * Includes
  */
 #include <chrysalix.h>
+#include "arch_context.h"
+#include "cx_sched.h"
 
 /************************************************************************************
  * Driver Includes
@@ -76,3 +78,16 @@ static const struct device_init_table g_drv_table[] = {
 i32 arch_drivers_load(void) {
     return (cx_drivers_load(g_drv_table, NUM_DEV_TABLE_ENTRIES));
 }
+
+/* ------------------------------------------------------------ */
+void arch_idle(i32 timeout) {
+    /*
+     * The console is the only source of external input, so
+     * let it park the first cpu.  The others only wait to be
+     * kicked.
+     */
+    if (0 == arch_cpu_id())
+        tty_idle(timeout);
+    else
+        linux_cpu_idle(timeout);
+}
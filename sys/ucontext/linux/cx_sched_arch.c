@@ -0,0 +1,120 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * @file cx_sched_arch.c
+ *      Scheduler hooks shared by the Linux context backends
+ */
+
+/****************************************************************
+ * Includes
+ */
+#include <chrysalix.h>
+#include <arch_context.h>
+#include "cx_sched.h"
+
+/**
+ * Yield !
+ *
+ * The yielding thread picks the next thread itself and switches
+ * straight to it.  The scheduler context is only used when there
+ * is nothing to run and the system has to idle.  Called with the
+ * kernel lock held.
+ */
+void arch_yield(void) {
+    PCB_t *next, *pcb;
+
+    pcb = cx_get_current_pcb();
+    next = cx_sched_dispatch();
+    if (NULL == next) {
+        cx_sched_switch(pcb, cx_get_sched_pcb());
+    } else if (next != pcb) {
+        cx_sched_switch(pcb, next);
+    }
+}
+
+/* ------------------------------------------------------------ */
+u64 arch_get_mtime(void) {
+    return (linux_get_mtime());
+}
+
+/*
+ * Cycle counter used for thread run times.  It is read on every
+ * switch, so it has to be cheap; the time stamp counter on x86-64
+ * and the virtual counter on aarch64 are readable without a system
+ * call.  Elsewhere fall back to usecs.
+ */
+u64 arch_get_cycles(void) {
+#if defined(__x86_64__)
+    u32 lo, hi;
+
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return (((u64) hi << 32) | lo);
+#elif defined(__aarch64__)
+    u64 cnt;
+
+    __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(cnt));
+    return (cnt);
+#else
+    return (linux_get_usecs());
+#endif
+}
+
+/*
+ * Cycles this cpu has run for, counted from the host's run time for
+ * it, so time the host had it off is left out.  It costs a system
+ * call, so it is only read once a pick.
+ */
+u64 arch_get_cpu_cycles(void) {
+    return (linux_get_cpu_usecs() * arch_get_cycle_rate() / 1000);
+}
+
+/*
+ * Counter cycles per msec
+ */
+u64 arch_get_cycle_rate(void) {
+    static u64 rate;
+    u64 start_usecs, start_cycles, usecs;
+
+    /*
+     * Measure the counter against host time once, the first
+     * time the rate is needed
+     */
+    if (0 == rate) {
+        start_usecs = linux_get_usecs();
+        start_cycles = arch_get_cycles();
+        do {
+            usecs = linux_get_usecs() - start_usecs;
+        } while (2000 > usecs);
+        rate = (arch_get_cycles() - start_cycles) * 1000 / usecs;
+        if (0 == rate)
+            rate = 1;
+    }
+    return (rate);
+}
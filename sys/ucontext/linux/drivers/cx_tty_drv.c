@@ -72,6 +72,19 @@ i32 tty_init(drv_t minor) {
     return (0);
 }
 
+/**
+ * Called by the scheduler when no thread is able to run.  Parks
+ * the process until there is input or the timeout expires, and
+ * wakes up any thread waiting for input.
+ *
+ * @param timeout
+ *    Maximum time to wait in msecs, or -1 to wait forever
+ */
+void tty_idle(i32 timeout) {
+    if (lc_poll(timeout))
+        cx_event_post(TTY_EVENT_RX);
+}
+
 /**
  * Reads from standard in
  *
@@ -82,14 +95,37 @@ i32 tty_init(drv_t minor) {
  * @param buflen
  *    Number of bytes to copy from buf to debug port
  * @param timeout
- *    Amount of time to wait before exiting function
+ *    Amount of time to wait in msecs before exiting function.
+ *    0 does not wait, -1 waits until there is input.
  *
  * @return
  *   Number of bytes written, or
  *      -1 for failure.
  */
-static i32 tty_read(_UNUSED_ fd_t fd, void *buf, i32 size, _UNUSED_ i32 timeout) {
-    return (lc_read(buf, size));
+static i32 tty_read(_UNUSED_ fd_t fd, void *buf, i32 size, i32 timeout) {
+    i32 retval;
+    i32 wait;
+
+    while (1) {
+        retval = lc_read(buf, size);
+        if ((0 < retval) || (0 == timeout))
+            return (retval);
+
+        /*
+         * Sleep until the scheduler sees input while idle, or
+         * until it is time to check again
+         */
+        wait = TTY_POLL_MSECS;
+        if ((0 < timeout) && (timeout < wait))
+            wait = timeout;
+        (void) cx_event_wait(TTY_EVENT_RX, wait);
+
+        if (0 < timeout) {
+            timeout -= wait;
+            if (0 == timeout)
+                return (lc_read(buf, size));
+        }
+    }
 }
 
 /**
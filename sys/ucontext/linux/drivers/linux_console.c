@@ -34,8 +34,17 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <cx_arch.h>
+#include <arch_context.h>
 #include "linux_console.h"
 
+/************************************************************************************
+ * Globals
+ */
+    /** Set once stdin has been closed */
+static i32 lc_eof;
+
 void lc_init(void) {
     i32 orig;
 
@@ -49,7 +58,45 @@ void lc_init(void) {
 
 
 i32 lc_read(void *buf, i32 size) {
-    return (read(0, buf, size));
+    i32 retval;
+
+    retval = read(0, buf, size);
+    if (0 == retval)
+        lc_eof = 1;
+
+    return (retval);
+}
+
+/**
+ * Block the process until there is input on stdin or
+ * @p timeout msecs have passed.  A @p timeout of -1 waits
+ * forever.  With several cpus, a kick from another cpu also
+ * ends the wait.
+ *
+ * @return
+ *    1 if there is input available, 0 otherwise
+ */
+i32 lc_poll(i32 timeout) {
+    struct pollfd pfd[2];
+
+    /*
+     * Nothing more will ever come from a closed stdin, so
+     * only wait for the timeout or a kick.  poll() skips
+     * negative descriptors.
+     */
+    pfd[0].fd = lc_eof ? -1 : 0;
+    pfd[0].events = POLLIN;
+    pfd[0].revents = 0;
+    pfd[1].fd = linux_cpu_wakefd();
+    pfd[1].events = POLLIN;
+    pfd[1].revents = 0;
+    if (0 >= poll(pfd, 2, timeout))
+        return (0);
+
+    if (0 != pfd[1].revents)
+        linux_cpu_drain();
+
+    return (0 != pfd[0].revents);
 }
 
 i32 lc_write(void *buf, i32 size) {
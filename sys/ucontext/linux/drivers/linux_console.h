@@ -38,5 +38,6 @@ i32 lc_read( void             *buf,
                 i32           size );
 i32 lc_write( void             *buf,
                 i32           size);
+i32 lc_poll( i32           timeout );
 
 #endif /* _LINUX_CONSOLE_H */
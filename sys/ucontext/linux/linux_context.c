@@ -27,12 +27,14 @@
  * SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include <sys/time.h>
+#include <time.h>
 
 #include <arch_types.h>
 #include <arch_context.h>
@@ -70,3 +72,24 @@ u64 linux_get_mtime(void) {
 
     return ((second - first));
 }
+
+/*
+ * Host time in usecs, for measuring the cycle counter against
+ */
+u64 linux_get_usecs(void) {
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return ((u64) now.tv_sec * 1000000 + (u64) now.tv_usec);
+}
+
+/*
+ * Time the host has run the calling thread, which is one cpu, in
+ * usecs.  Time the host gave to something else is not in it.
+ */
+u64 linux_get_cpu_usecs(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return ((u64) now.tv_sec * 1000000 + (u64) now.tv_nsec / 1000);
+}
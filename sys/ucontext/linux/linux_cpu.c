@@ -0,0 +1,159 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * @file linux_cpu.c
+ *      Virtual cpus as host threads
+ *
+ * Each cpu other than the first is a pthread that switches into its
+ * own scheduler context.  The kernel lock is a plain mutex; the
+ * kernel keeps the recursion count.  A parked cpu waits in poll() on
+ * its own pipe, and a byte written there wakes it up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <arch_types.h>
+#include <cx_arch.h>
+#include <arch_context.h>
+
+void cx_cpu_start(u32 id);
+
+/****************************************************************
+ * Globals
+ */
+static __thread u32 cpu_self;
+
+#if ARCH_NCPUS > 1
+static pthread_mutex_t kernel_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t cpu_thread[ARCH_NCPUS];
+static int cpu_wake[ARCH_NCPUS][2];
+#endif
+
+/* ------------------------------------------------------------ */
+u32 arch_cpu_id(void) {
+    return (cpu_self);
+}
+
+#if ARCH_NCPUS > 1
+
+/* ------------------------------------------------------------ */
+void arch_cpu_init(void) {
+    u32 i;
+
+    for (i = 0; i < ARCH_NCPUS; i++) {
+        if (0 != pipe(cpu_wake[i])) {
+            perror("pipe");
+            exit(1);
+        }
+        (void) fcntl(cpu_wake[i][0], F_SETFL, O_NONBLOCK);
+        (void) fcntl(cpu_wake[i][1], F_SETFL, O_NONBLOCK);
+    }
+}
+
+/* ------------------------------------------------------------ */
+static void *linux_cpu_main(void *arg) {
+    cpu_self = (u32) (unsigned long) arg;
+    cx_cpu_start(cpu_self);
+
+    /* NEVER REACHED */
+    return (NULL);
+}
+
+/* ------------------------------------------------------------ */
+void arch_cpu_start(u32 cpu) {
+    if (0 != pthread_create(&cpu_thread[cpu], NULL, linux_cpu_main,
+                            (void *) (unsigned long) cpu)) {
+        perror("pthread_create");
+        exit(1);
+    }
+}
+
+/* ------------------------------------------------------------ */
+void arch_cpu_kick(u32 cpu) {
+    char c = 0;
+
+    /*
+     * A full pipe already has a wakeup pending
+     */
+    (void) write(cpu_wake[cpu][1], &c, 1);
+}
+
+/* ------------------------------------------------------------ */
+void arch_kernel_lock(void) {
+    pthread_mutex_lock(&kernel_lock);
+}
+
+/* ------------------------------------------------------------ */
+void arch_kernel_unlock(void) {
+    pthread_mutex_unlock(&kernel_lock);
+}
+
+/* ------------------------------------------------------------ */
+int linux_cpu_wakefd(void) {
+    return (cpu_wake[cpu_self][0]);
+}
+
+/* ------------------------------------------------------------ */
+void linux_cpu_drain(void) {
+    char buf[16];
+
+    while (0 < read(cpu_wake[cpu_self][0], buf, sizeof(buf)));
+}
+
+#else /* ARCH_NCPUS > 1 */
+
+/*
+ * A single cpu is never kicked, so there is nothing to wait on
+ * besides the console
+ */
+int linux_cpu_wakefd(void) {
+    return (-1);
+}
+
+void linux_cpu_drain(void) {
+}
+
+#endif /* ARCH_NCPUS > 1 */
+
+/* ------------------------------------------------------------ */
+void linux_cpu_idle(i32 timeout) {
+    struct pollfd pfd;
+
+    pfd.fd = linux_cpu_wakefd();
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (0 < poll(&pfd, 1, timeout))
+        linux_cpu_drain();
+}
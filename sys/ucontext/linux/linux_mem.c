@@ -0,0 +1,89 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * @file linux_mem.c
+ *      Memory for the kernel's own tables and thread stacks
+ *
+ * Large tables that grow at run time, like the PCB slabs, and thread
+ * stacks are mapped straight from the host instead of taken out of
+ * the OS heap.  The host hands out pages cleared and only backs them
+ * once they are touched.
+ */
+
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <arch_types.h>
+#include <cx_arch.h>
+
+/* ------------------------------------------------------------ */
+void *arch_mem_map(u32 size) {
+    void *mem;
+
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == mem)
+        return (NULL);
+    return (mem);
+}
+
+/* ------------------------------------------------------------ */
+void arch_mem_unmap(void *mem, u32 size) {
+    (void) munmap(mem, size);
+}
+
+/*
+ * Map a stack of @p size bytes with a guard page below it.  Returns
+ * the lowest usable address.
+ */
+void *arch_stack_map(u32 size) {
+    long page = sysconf(_SC_PAGESIZE);
+    u8 *mem;
+
+    mem = mmap(NULL, size + page, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+               -1, 0);
+    if (MAP_FAILED == mem)
+        return (NULL);
+    if (0 != mprotect(mem, page, PROT_NONE)) {
+        (void) munmap(mem, size + page);
+        return (NULL);
+    }
+    return (mem + page);
+}
+
+/* ------------------------------------------------------------ */
+void arch_stack_unmap(void *stack, u32 size) {
+    long page = sysconf(_SC_PAGESIZE);
+
+    (void) munmap((u8 *) stack - page, size + page);
+}
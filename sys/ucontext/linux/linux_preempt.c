@@ -0,0 +1,124 @@
+/*-
+ * Copyright (c) 2006 Luis Pabon, Jr. <lpabon@chrysalix.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/**
+ * @file linux_preempt.c
+ *      Time slice interrupt
+ *
+ * Every cpu has a timer on its host thread's cpu time clock that
+ * raises SIGALRM on that thread each time slice.  The clock only
+ * runs while the thread does, so a parked cpu takes no interrupts.
+ *
+ * The handler runs on the stack of the thread interrupted and may
+ * switch away from it there.  The interrupt returns when the thread
+ * is switched back in, possibly on another host thread.  SIGALRM is
+ * not blocked in the handler, since the threads run after it would
+ * otherwise never be interrupted; the kernel keeps it from nesting.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arch_types.h>
+#include <cx_arch.h>
+#include <arch_context.h>
+
+void cx_cpu_tick(void);
+u32 arch_cpu_id(void);
+void arch_preempt_set(u32 cpu, u32 msecs);
+
+    /* Older C libraries only have the kernel's name for it */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id  _sigev_un._tid
+#endif
+
+/****************************************************************
+ * Globals
+ */
+static timer_t cpu_timer[ARCH_NCPUS];
+static int cpu_timer_set[ARCH_NCPUS];
+
+/* ------------------------------------------------------------ */
+static void linux_preempt_tick(int sig) {
+    int saved_errno = errno;
+
+    (void) sig;
+    cx_cpu_tick();
+    errno = saved_errno;
+}
+
+/* ------------------------------------------------------------ */
+void arch_preempt_init(u32 msecs) {
+    struct sigaction sa;
+    struct sigevent sev;
+    u32 cpu = arch_cpu_id();
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = linux_preempt_tick;
+    sa.sa_flags = SA_RESTART | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    if (0 != sigaction(SIGALRM, &sa, NULL)) {
+        perror("sigaction");
+        exit(1);
+    }
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGALRM;
+    sev.sigev_notify_thread_id = gettid();
+    if (0 != timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &cpu_timer[cpu])) {
+        perror("timer_create");
+        exit(1);
+    }
+    cpu_timer_set[cpu] = 1;
+
+    arch_preempt_set(cpu, msecs);
+}
+
+/* ------------------------------------------------------------ */
+void arch_preempt_set(u32 cpu, u32 msecs) {
+    struct itimerspec its;
+
+    /*
+     * A cpu that has not started yet arms its timer when it does
+     */
+    if (!cpu_timer_set[cpu])
+        return;
+
+    its.it_value.tv_sec = msecs / 1000;
+    its.it_value.tv_nsec = (long) (msecs % 1000) * 1000000L;
+    its.it_interval = its.it_value;
+    (void) timer_settime(cpu_timer[cpu], 0, &its, NULL);
+}
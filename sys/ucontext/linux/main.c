@@ -96,10 +96,3 @@ int main(void) {
      */
     return (123);
 }
-
-unsigned long cx_intsoff(void) {
-    return 0;
-}
-
-void cx_intson(_UNUSED_ unsigned long s) {
-};